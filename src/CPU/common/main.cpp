@@ -4,10 +4,12 @@
  * License: Apache 2.0 (see attachached File)
  */
 #include <chrono>
+#include <fstream>
 #include <iostream>
 #include <string.h>
 #include <stdlib.h>
 #include "benchmark.h"
+#include "latency.h"
 
 // fields for runtime measurement
 std::chrono::high_resolution_clock::time_point start,end;
@@ -16,6 +18,13 @@ std::chrono::high_resolution_clock timer;
 bool pause = false;
 // number of testcases to process before comparison and reading the next set of test data
 int pipelined = 1;
+// whether reading, computation and comparison overlap
+bool asynchronous = false;
+// fields for per testcase runtime measurement
+std::chrono::high_resolution_clock::time_point testcase_start;
+latency_recorder latencies;
+// file to write the latency report to
+const char* latency_file = nullptr;
 // the kernel to execute
 extern kernel& myKernel;
 /**
@@ -34,57 +43,104 @@ void unpause_timer()
 {
   pause = false;
   start = timer.now();
+  testcase_start = start;
+}
+/**
+ * Records the duration of the testcase that has just been processed.
+ */
+void testcase_timer()
+{
+  std::chrono::high_resolution_clock::time_point now = timer.now();
+  latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - testcase_start).count());
+  testcase_start = now;
 }
 /**
  * Displays usage information
  */
 void usage(char *exec)
 {
-  std::cout << "Usage: \n" << exec << " [-p N]\nOptions:\n  -p N   executes N invocations in sequence,";
+  std::cout << "Usage: \n" << exec << " [-p N] [-a] [-l FILE]\nOptions:\n  -p N   executes N invocations in sequence,";
   std::cout << "before taking time and check the result.\n";
   std::cout << "         Default: N=1\n";
+  std::cout << "  -a     reads the next and checks the previous invocations on separate threads\n";
+  std::cout << "         while the current invocations execute.\n";
+  std::cout << "  -l FILE writes the runtime percentiles and histogram of the individual invocations\n";
+  std::cout << "         to FILE in JSON format.\n";
 }
 int main(int argc, char **argv) {
-	// parse the pipelined argument
-	if ((argc != 1) && (argc !=  3))
+	// parse the arguments
+	for (int i = 1; i < argc; i++)
 	{
-		usage(argv[0]);
-		exit(2);
-	}
-	if (argc == 3)
-	{
-		if (strcmp(argv[1], "-p") != 0)
+		if (strcmp(argv[i], "-a") == 0)
+		{
+			asynchronous = true;
+			std::cout << "Overlapping data reading, kernel execution and checking\n";
+			continue;
+		}
+		if (strcmp(argv[i], "-l") == 0)
+		{
+			if (i + 1 == argc)
+			{
+				usage(argv[0]);
+				exit(2);
+			}
+			latency_file = argv[++i];
+			continue;
+		}
+		if (strcmp(argv[i], "-p") != 0)
 		{
 			usage(argv[0]);
 			exit(3);
 		}
+		if (i + 1 == argc)
+		{
+			usage(argv[0]);
+			exit(2);
+		}
 		errno = 0;
-		pipelined = strtol(argv[2], NULL, 10);
+		pipelined = strtol(argv[++i], NULL, 10);
 		if (errno || (pipelined < 1) )
 		{
 			usage(argv[0]);
 			exit(4);
 		}
 		std::cout << "Invoking kernel " << pipelined << " time(s) per measure/checking step\n";
-		
 	}
 	// prepare the kernel
-	myKernel.set_timer_functions(pause_timer, unpause_timer);
+	myKernel.set_timer_functions(pause_timer, unpause_timer, testcase_timer);
 	myKernel.init();
 	// start measuring the runtime of the kernel
 	start = timer.now();
+	testcase_start = start;
+	std::chrono::high_resolution_clock::time_point total_start = start;
 	// execute the kernel
-	myKernel.run(pipelined);
+	if (asynchronous)
+		myKernel.run_pipelined(pipelined);
+	else
+		myKernel.run(pipelined);
 	// measure the runtime of the kernel
+	std::chrono::high_resolution_clock::time_point total_end = timer.now();
 	if (!pause) 
 	{
-		end = timer.now();
+		end = total_end;
 		elapsed += end-start;
 	}
+	// including data reading and checking
+	std::chrono::duration<double> total = total_end - total_start;
 	// display results
 	std::cout <<  "elapsed time: "<< elapsed.count() << " seconds, average time per testcase (#"
 			<< myKernel.testcases << "): " << elapsed.count() / (double) myKernel.testcases
 			<< " seconds" << std::endl;
+	std::cout << "end-to-end time: " << total.count() << " seconds, throughput: "
+			<< myKernel.testcases / total.count() << " testcases per second" << std::endl;
+	latencies.write_summary(std::cout);
+	if (latency_file)
+	{
+		std::ofstream latency_report(latency_file);
+		latencies.write_json(latency_report);
+		if (!latency_report)
+			std::cerr << "Error writing the latency report" << std::endl;
+	}
 	if (myKernel.check_output())
 	{
 		std::cout << "result ok\n";
@@ -6,8 +6,11 @@
 #ifndef DATATYPES_H
 #define DATATYPES_H
 
+#include <utility>
 #include <vector>
 
+#include "mapped_file.h"
+
 typedef struct  {
 	float x,y,z;
 } Point;
@@ -45,6 +48,8 @@ typedef struct{
 
 typedef std::vector<Point> PointCloud;
 typedef std::vector<PointRGB> PointCloudRGB;
+// point cloud stored in a mapped data file
+typedef mapped_array<Point> PointCloudView;
     
 typedef struct {
     std::vector<PointDouble> points;
@@ -54,9 +59,88 @@ typedef struct {
    std::vector<Boundingbox> boxes;
 } BoundingboxArray;
 
-typedef struct PointIndices {
-    std::vector<int> indices;
-} PointIndices;
+/**
+ * Cluster whose point indices are stored in a range of a shared index array.
+ */
+typedef struct {
+	// position of the first point index
+	size_t start;
+	// number of points
+	size_t size;
+} ClusterRange;
+
+/**
+ * Uniform grid over a point cloud used for radius search.
+ * Only occupied cells are stored, sorted by their linearized cell index.
+ */
+typedef struct {
+	// squared search radius
+	float radius_sqr;
+	// edge length of a cell
+	double cell_size;
+	// grid origin
+	double min_x, min_y, min_z;
+	// number of cells in each dimension
+	int64_t dim_x, dim_y, dim_z;
+	// linearized indices of the occupied cells in ascending order
+	std::vector<int64_t> cell_keys;
+	// offset of each occupied cell in point_order, with one additional end marker
+	std::vector<int> cell_start;
+	// point indices grouped by cell
+	std::vector<int> point_order;
+	// cell coordinates of each point, three entries per point
+	std::vector<int64_t> point_cell;
+	// linearized cell index and index of each point, used to sort the points by cell
+	std::vector<std::pair<int64_t, int> > cell_points;
+} RadiusSearchGrid;
+
+/**
+ * Storage for the convex hull computation that is reused for all clusters.
+ */
+typedef struct {
+	// sortable point coordinates
+	std::vector<uint64_t> keys;
+	// intermediate radix sort results
+	std::vector<uint64_t> swap;
+	// hull points in clockwise order
+	std::vector<Point2D> hull;
+} HullBuffer;
+
+/**
+ * Cluster in the output point cloud for which the pose has to be estimated.
+ */
+typedef struct {
+	// position of the first point in the output cloud
+	size_t start;
+	// number of points
+	size_t size;
+	// index of the bounding box
+	size_t box;
+} ClusterSpan;
+
+/**
+ * Storage for clustering a point cloud that is reused for all point clouds.
+ * The containers are cleared instead of freed, so they only allocate memory
+ * when a point cloud needs more than all previous ones.
+ */
+typedef struct {
+	// radius search grid of the point cloud
+	RadiusSearchGrid grid;
+	// processed status of each point
+	std::vector<bool> processed;
+	// radius search results
+	std::vector<int> nn_indices;
+	// candidate cluster
+	std::vector<int> seed_queue;
+	// point indices of all clusters, one cluster after another
+	std::vector<int> cluster_indices;
+	// clusters of the point cloud
+	std::vector<ClusterRange> clusters;
+	// accepted clusters that need pose estimation
+	std::vector<ClusterSpan> pose_spans;
+	// convex hull storage
+	HullBuffer hull;
+} ClusteringBuffer;
 
 #define PI 3.1415926535897932384626433832795
 
@@ -4,14 +4,18 @@
  * License: Apache 2.0 (see attachached File)
  */
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <limits>
 #include <cmath>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 
 #include "benchmark.h"
 #include "datatypes.h"
+#include "mapped_file.h"
+#include "pipeline.h"
+#include "pooled_array.h"
 
 // algorithm parameters
 const int _cluster_size_min = 20;
@@ -20,41 +24,65 @@ const bool _pose_estimation = true;
 
 // maximum allowed deviation from the reference data
 #define MAX_EPS 0.001
+// minimum number of points for which the convex hull points are radix sorted
+#define HULL_RADIX_MIN 256
+
+/**
+ * Input data and results of testcases that are processed in one step.
+ */
+typedef struct {
+	// index of the first testcase
+	int first = 0;
+	// number of testcases
+	int count = 0;
+	// input point clouds
+	pooled_array<PointCloudView> in_cloud_ptr;
+	// colored point clouds
+	pooled_array<PointCloudRGB> out_cloud_ptr;
+	// bounding boxes of the input clouds
+	pooled_array<BoundingboxArray> out_boundingbox_array;
+	// detected centroids
+	pooled_array<Centroid> out_centroids;
+} TestcaseBatch;
 
 class euclidean_clustering : public kernel {
 private:
-	// input point cloud
-	PointCloud *in_cloud_ptr = nullptr;
-	// colored point cloud
-	PointCloudRGB *out_cloud_ptr = nullptr;
-	// bounding boxes of the input cloud
-	BoundingboxArray *out_boundingbox_array = nullptr;
-	// detected centroids
-	Centroid *out_centroids = nullptr;
+	// testcases processed in the current step
+	TestcaseBatch current_batch;
 	// the number of testcases that have been read
 	int read_testcases = 0;
-	// testcase and reference data streams
-	std::ifstream input_file, output_file;
+	// testcase and reference data files
+	mapped_file input_file, output_file;
 	// indicates an size related error
 	bool error_so_far = false;
 	// the measured maximum deviation from the reference data
 	double max_delta = 0.0;
+	// input points categorized by their distance from the origin
+	PointCloud cloud_segments_array[5];
+	// storage of the clustering steps, kept between testcases
+	ClusteringBuffer clustering_buffer;
+	// reference results of the testcase that is checked
+	PointCloudRGB reference_out_cloud;
+	BoundingboxArray reference_bb_array;
+	Centroid reference_centroids;
 public:
 	virtual void init();
 	virtual void run(int p = 1);
+	virtual void run_pipelined(int p = 1);
 	virtual bool check_output();
 protected:
 	void clusterAndColor(const PointCloud *in_cloud_ptr,
 		PointCloudRGB *out_cloud_ptr,
 		BoundingboxArray *in_out_boundingbox_array,
 		Centroid *in_out_centroids,
+		ClusteringBuffer& buffer,
 		double in_max_cluster_distance);
 	/**
 	 * Cluster the point cloud according to the pairwise point distances.
 	 * Clustering of the same input data is performed multiple times with different thresholds
 	 * so that points farther away in the cloud also get assigned to a cluster.
 	 */
-	void segmentByDistance(const PointCloud *in_cloud_ptr,
+	void segmentByDistance(const PointCloudView *in_cloud_ptr,
 		PointCloudRGB *out_cloud_ptr,
 		BoundingboxArray *in_out_boundingbox_array,
 		Centroid *in_out_centroids,
@@ -62,7 +90,7 @@ protected:
 	/**
 	 * Reads the number of testcases in the data set.
 	 */
-	int read_number_testcases(std::ifstream& input_file);
+	int read_number_testcases(mapped_file& input_file);
 	/**
 	 * Reads the next testcase input data structures.
 	 * count: number of testcase datasets to read
@@ -70,18 +98,36 @@ protected:
 	 */
 	virtual int read_next_testcases(int count);
 	/**
-	 * Reads and compares algorithm outputs with the reference result.
-	 * count: the number of outputs to compare
+	 * Reads and compares algorithm outputs with the reference result of the current batch.
+	 */
+	virtual void check_next_outputs();
+	/**
+	 * Reads the next testcases into a batch, replacing its previous contents.
+	 * batch: the batch to fill
+	 * count: number of testcase datasets to read
+	 * return: the number of testcases datasets actually read
 	 */
-	virtual void check_next_outputs(int count);
+	int read_batch(TestcaseBatch& batch, int count);
+	/**
+	 * Runs the algorithm on all testcases of a batch.
+	 */
+	void compute_batch(TestcaseBatch& batch);
+	/**
+	 * Compares the results of a batch with the reference result.
+	 */
+	void check_batch(TestcaseBatch& batch);
+	/**
+	 * Releases the memory held by a batch.
+	 */
+	void free_batch(TestcaseBatch& batch);
 };
 
-int euclidean_clustering::read_number_testcases(std::ifstream& input_file)
+int euclidean_clustering::read_number_testcases(mapped_file& input_file)
 {
 	int32_t number;
 	try {
-		input_file.read((char*)&(number), sizeof(int32_t));
-	} catch (std::ifstream::failure) {
+		number = input_file.read<int32_t>();
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading the number of testcases");
 	}
 	return number;
@@ -281,218 +327,158 @@ static void rotatingCalipers(const Point2D* points, int n, float* out)
 }
 
 /**
- * Helper function for convex hull calculation
+ * Maps a coordinate to an unsigned integer with the same order,
+ * so that points can be sorted by their coordinates without loss of precision.
+ * Negative values have all bits inverted, positive values only the sign bit.
  */
-static int sklansky(Point2D** array, int start, int end, int* stack, int nsign, int sign2)
+inline uint32_t orderedBits(float value)
 {
-	int incr = end > start ? 1 : -1;
-	// prepare first triangle
-	int pprev = start, pcur = pprev + incr, pnext = pcur + incr;
-	int stacksize = 3;
-
-	if (start == end ||
-		(array[start]->x == array[end]->x &&
-		array[start]->y == array[end]->y))
-	{
-		stack[0] = start;
-		return 1;
-	}
-	stack[0] = pprev;
-	stack[1] = pcur;
-	stack[2] = pnext;
+	// -0 and 0 are mapped to the same integer
+	value += 0.0f;
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(float));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
 
-	end += incr;
+/**
+ * Restores a coordinate from the result of orderedBits().
+ */
+inline float orderedFloat(uint32_t bits)
+{
+	bits = (bits & 0x80000000u) ? (bits & 0x7fffffffu) : ~bits;
+	float value;
+	std::memcpy(&value, &bits, sizeof(float));
+	return value;
+}
 
-	while( pnext != end )
+/**
+ * Sorts the point keys in ascending order.
+ * Short sequences are sorted by comparison. Longer ones are sorted with a least significant digit radix sort
+ * that counts all eight byte digits in a single pass and skips the digits that are equal for all keys.
+ * keys: the keys to sort
+ * swap: storage for the intermediate results
+ */
+static void sortKeys(std::vector<uint64_t>& keys, std::vector<uint64_t>& swap)
+{
+	size_t n = keys.size();
+	if (n < HULL_RADIX_MIN)
 	{
-		// check the angles p1,p2,p3
-		float cury = array[pcur]->y;
-		float nexty = array[pnext]->y;
-		float by = nexty - cury;
-
-		if((by > 0) - (by < 0) != nsign )
+		std::sort(keys.begin(), keys.end());
+		return;
+	}
+	size_t histogram[8][256] = {};
+	for (size_t i = 0; i < n; i++)
+	{
+		uint64_t key = keys[i];
+		for (int d = 0; d < 8; d++)
+			histogram[d][(key >> (8*d)) & 0xff]++;
+	}
+	swap.resize(n);
+	uint64_t* from = keys.data();
+	uint64_t* to = swap.data();
+	for (int d = 0; d < 8; d++)
+	{
+		size_t* count = histogram[d];
+		if (count[(from[0] >> (8*d)) & 0xff] == n)
+			continue;
+		// turn the digit counts into output positions
+		size_t offset = 0;
+		for (int b = 0; b < 256; b++)
 		{
-			float ax = array[pcur]->x - array[pprev]->x;
-			float bx = array[pnext]->x - array[pcur]->x;
-			float ay = cury - array[pprev]->y;
-			float convexity = ay*bx - ax*by; // convexity > 0 -> convex angle
-
-			if(((convexity > 0) - (convexity < 0)) == sign2 && (ax != 0 || ay != 0) )
-			{
-				pprev = pcur;
-				pcur = pnext;
-				pnext += incr;
-				stack[stacksize] = pnext;
-				stacksize++;
-			}
-			else
-			{
-				if( pprev == start )
-				{
-					pcur = pnext;
-					stack[1] = pcur;
-					pnext += incr;
-					stack[2] = pnext;
-				}
-				else
-				{
-					stack[stacksize-2] = pnext;
-					pcur = pprev;
-					pprev = stack[stacksize-4];
-					stacksize--;
-				}
-			}
+			size_t c = count[b];
+			count[b] = offset;
+			offset += c;
 		}
-		else
+		for (size_t i = 0; i < n; i++)
 		{
-			pnext += incr;
-			stack[stacksize-1] = pnext;
+			uint64_t key = from[i];
+			to[count[(key >> (8*d)) & 0xff]++] = key;
 		}
+		std::swap(from, to);
 	}
-	return --stacksize;
+	if (from != keys.data())
+		keys.swap(swap);
 }
 
-
 /**
- * Extension for for point comparison
+ * Computes the cross product of the edges a->b and b->c.
+ * It is negative for a clockwise turn.
  */
-struct CHullCmpPoints
+inline double turn(const Point2D& a, const Point2D& b, const Point2D& c)
 {
-	/**
-	 * Compares two points.
-	 * Performs a primary test for the x component
-	 * and a secondary test for the y component.
-	 */
-	bool operator()(const Point2D* p1, const Point2D* p2) const
-	{ 
-		return p1->x < p2->x || (p1->x == p2->x && p1->y < p2->y);
-	}
-};
-
+	return ((double)b.x - a.x)*((double)c.y - b.y) - ((double)b.y - a.y)*((double)c.x - b.x);
+}
 
 /**
- * Helper function that computes the convex hull.
+ * Computes the convex hull of the x and y coordinates of consecutive points with Andrew's monotone chain.
+ * The hull is stored in clockwise order, starting with the point that has the smallest coordinates.
+ * Collinear points are not part of the hull.
+ * points: first point
+ * n: number of points
+ * buffer: sort buffers and resulting hull
+ * return: the number of hull points
  */
-void convexHull(
-	std::vector<Point2D> _points, std::vector<Point2D>&  _hull, bool clockwise, bool returnPoints )
+static int convexHull(const PointRGB* points, size_t n, HullBuffer& buffer)
 {
-	int i, total = _points.size(), nout = 0;
-	int miny_ind = 0, maxy_ind = 0;
-	// test for empty input
-	if( total == 0 )
+	std::vector<uint64_t>& keys = buffer.keys;
+	std::vector<Point2D>& hull = buffer.hull;
+	// sort by x, then by y, and remove duplicates
+	keys.resize(n);
+	for (size_t i = 0; i < n; i++)
+		keys[i] = (uint64_t)orderedBits(points[i].x) << 32 | orderedBits(points[i].y);
+	sortKeys(keys, buffer.swap);
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	int m = keys.size();
+	hull.resize(2*m);
+	if (m < 3)
 	{
-		_hull.clear();
-		return;
+		for (int i = 0; i < m; i++)
+			hull[i] = { orderedFloat(keys[i] >> 32), orderedFloat(keys[i] & 0xffffffffu) };
+		return m;
 	}
-
-	Point2D** _pointer = (Point2D**)alloca(total * sizeof(Point2D*));
-	int* _stack = (int*)alloca((total +2) * sizeof(int));
-	int* _hullbuf= (int*)alloca(total * sizeof(int));
-	Point2D** pointer = _pointer;
-	Point2D** pointerf = (Point2D**)pointer;
-	Point2D* data0 = _points.data();
-	int* stack = _stack;
-	int* hullbuf = _hullbuf;
-
-	for( i = 0; i < total; i++ )
-		pointer[i] = &data0[i];
-
-	// sort the point set by x-coordinate, find min and max y
-	std::sort(pointerf, pointerf + total, CHullCmpPoints());
-	for( i = 1; i < total; i++ )
-		{
-			float y = pointerf[i]->y;
-			if( pointerf[miny_ind]->y > y )
-				miny_ind = i;
-			if( pointerf[maxy_ind]->y < y )
-				maxy_ind = i;
-		}
-
-	if( pointer[0]->x == pointer[total-1]->x &&
-		pointer[0]->y == pointer[total-1]->y )
+	int k = 0;
+	// upper chain from left to right
+	for (int i = 0; i < m; i++)
 	{
-		hullbuf[nout++] = 0;
+		Point2D p = { orderedFloat(keys[i] >> 32), orderedFloat(keys[i] & 0xffffffffu) };
+		while (k >= 2 && turn(hull[k-2], hull[k-1], p) >= 0)
+			k--;
+		hull[k++] = p;
 	}
-	else
+	// lower chain from right to left
+	int lower_start = k + 1;
+	for (int i = m - 2; i >= 0; i--)
 	{
-		// upper half
-		int *tl_stack = stack;
-		int tl_count = sklansky( pointerf, 0, maxy_ind, tl_stack, -1, 1);
-		int *tr_stack = stack + tl_count;
-		int tr_count = sklansky( pointerf, total-1, maxy_ind, tr_stack, -1, -1);
-
-		// gather upper part of convex hull to output
-		if( !clockwise )
-		{
-			std::swap( tl_stack, tr_stack );
-			std::swap( tl_count, tr_count );
-		}
-
-		for( i = 0; i < tl_count-1; i++ )
-			hullbuf[nout++] = int(pointer[tl_stack[i]] - data0);
-		for( i = tr_count - 1; i > 0; i-- )
-			hullbuf[nout++] = int(pointer[tr_stack[i]] - data0);
-		int stop_idx = tr_count > 2 ? tr_stack[1] : tl_count > 2 ? tl_stack[tl_count - 2] : -1;
-
-		// lower half
-		int *bl_stack = stack;
-		int bl_count = sklansky( pointerf, 0, miny_ind, bl_stack, 1, -1);
-		int *br_stack = stack + bl_count;
-		int br_count = sklansky( pointerf, total-1, miny_ind, br_stack, 1, 1);
-
-		if( clockwise )
-		{
-			std::swap( bl_stack, br_stack );
-			std::swap( bl_count, br_count );
-		}
-
-		if( stop_idx >= 0 )
-		{
-			int check_idx = bl_count > 2 ? bl_stack[1] :
-			bl_count + br_count > 2 ? br_stack[2-bl_count] : -1;
-			if( check_idx == stop_idx || (check_idx >= 0 &&
-											pointer[check_idx]->x == pointer[stop_idx]->x &&
-											pointer[check_idx]->y == pointer[stop_idx]->y) )
-			{
-				// if all the points lie on the same line, then
-				// the bottom part of the convex hull is the mirrored top part
-				// (except the exteme points).
-				bl_count = std::min(bl_count, 2);
-				br_count = std::min(br_count, 2);
-			}
-		}
-
-		for( i = 0; i < bl_count-1; i++ )
-			hullbuf[nout++] = int(pointer[bl_stack[i]] - data0);
-		for( i = br_count-1; i > 0; i-- )
-			hullbuf[nout++] = int(pointer[br_stack[i]] - data0);
+		Point2D p = { orderedFloat(keys[i] >> 32), orderedFloat(keys[i] & 0xffffffffu) };
+		while (k >= lower_start && turn(hull[k-2], hull[k-1], p) >= 0)
+			k--;
+		hull[k++] = p;
 	}
-	// move result data
-	for( i = 0; i < nout; i++ )
-		_hull.push_back(data0[hullbuf[i]]);
+	// the chain ends with the first point again
+	return k - 1;
 }
 
 /**
- * Computes the rotation angle of the rectangle with minimum area.
+ * Computes the rotation angle of the rectangle with minimum area around consecutive points.
+ * points: first point
+ * n: number of points
+ * buffer: storage for the convex hull
  * return: the rotation angle in degrees
  */
-float minAreaRectAngle(std::vector<Point2D>& points)
+float minAreaRectAngle(const PointRGB* points, size_t n, HullBuffer& buffer)
 {
 	float angle = 0.0f;
-	std::vector<Point2D> hull;
 	Point2D out[3];
 
-	convexHull(points, hull, true, true);
-
-	int n = points.size();
-	const Point2D* hpoints = hull.data();
+	int hull_size = convexHull(points, n, buffer);
+	const Point2D* hpoints = buffer.hull.data();
 
-	if( n > 2 )
+	if( hull_size > 2 )
 	{
-		rotatingCalipers( hpoints, n, (float*)out );
+		rotatingCalipers( hpoints, hull_size, (float*)out );
 		angle = (float)atan2( (double)out[1].y, (double)out[1].x );
 	}
-	else if( n == 2 )
+	else if( hull_size == 2 )
 	{
 		double dx = hpoints[1].x - hpoints[0].x;
 		double dy = hpoints[1].y - hpoints[0].y;
@@ -502,52 +488,112 @@ float minAreaRectAngle(std::vector<Point2D>& points)
 }
 
 /**
- * Computes the pairwise squared distances. Results are stored in a matrix.
- * An entry of that matrix indicates whether the distance of the two described points 
- * is less or equal to the reference distance.
- * points: points for which we need pairwise distances with size N
- * sqr_distances: resulting distance matrix of size N*N
+ * Linearizes the cell coordinates of a radius search grid.
+ */
+inline int64_t linearizeCell(const RadiusSearchGrid& grid, int64_t x, int64_t y, int64_t z)
+{
+	return x + grid.dim_x*(y + grid.dim_y*z);
+}
+
+/**
+ * Sorts the points into a uniform grid with a cell size equal to the search radius.
+ * Near points can then only reside in the same or in directly adjacent cells.
+ * points: points for which we want to perform radius searches
+ * grid: resulting search grid
  * radius: reference distance
  */
-void initRadiusSearch(const std::vector<Point> &points, bool**  sqr_distances, float radius)
+void initRadiusSearch(const std::vector<Point> &points, RadiusSearchGrid& grid, float radius)
 {
 	int n = points.size();
-	float radius_sqr = radius * radius;
-	*sqr_distances = (bool*) malloc(n * n * sizeof(bool));
-	for (int j = 0; j < n; j++)
-		for (int i = 0; i < n; i++)
+	grid.radius_sqr = radius * radius;
+	// slightly enlarge the cells so that rounding can not separate near points by more than one cell
+	grid.cell_size = radius * (1.0 + 1e-5);
+	grid.cell_keys.clear();
+	grid.cell_start.clear();
+	grid.point_order.resize(n);
+	grid.point_cell.resize(3*n);
+	if (n == 0)
+		return;
+	// measure the cloud
+	double min_x = points[0].x, min_y = points[0].y, min_z = points[0].z;
+	double max_x = min_x, max_y = min_y, max_z = min_z;
+	for (int i = 1; i < n; i++)
+	{
+		min_x = std::min(min_x, (double)points[i].x);
+		min_y = std::min(min_y, (double)points[i].y);
+		min_z = std::min(min_z, (double)points[i].z);
+		max_x = std::max(max_x, (double)points[i].x);
+		max_y = std::max(max_y, (double)points[i].y);
+		max_z = std::max(max_z, (double)points[i].z);
+	}
+	grid.min_x = min_x;
+	grid.min_y = min_y;
+	grid.min_z = min_z;
+	grid.dim_x = (int64_t)((max_x - min_x)/grid.cell_size) + 1;
+	grid.dim_y = (int64_t)((max_y - min_y)/grid.cell_size) + 1;
+	grid.dim_z = (int64_t)((max_z - min_z)/grid.cell_size) + 1;
+	// assign each point to its cell
+	std::vector<std::pair<int64_t, int> >& keys = grid.cell_points;
+	keys.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		int64_t* cell = &grid.point_cell[3*i];
+		cell[0] = (int64_t)((points[i].x - grid.min_x)/grid.cell_size);
+		cell[1] = (int64_t)((points[i].y - grid.min_y)/grid.cell_size);
+		cell[2] = (int64_t)((points[i].z - grid.min_z)/grid.cell_size);
+		keys[i].first = linearizeCell(grid, cell[0], cell[1], cell[2]);
+		keys[i].second = i;
+	}
+	// group the points by cell
+	std::sort(keys.begin(), keys.end());
+	for (int i = 0; i < n; i++)
+	{
+		if (i == 0 || keys[i].first != keys[i - 1].first)
 		{
-			float dx = points[i].x - points[j].x;
-			float dy = points[i].y - points[j].y;
-			float dz = points[i].z - points[j].z;
-			float sqr_distance = dx*dx + dy*dy + dz*dz;
-			(*sqr_distances)[j*n+i] = sqr_distance <= radius_sqr;
+			grid.cell_keys.push_back(keys[i].first);
+			grid.cell_start.push_back(i);
 		}
+		grid.point_order[i] = keys[i].second;
+	}
+	grid.cell_start.push_back(n);
 }
 
-
 /**
- * Performs radius search for a single point using a precomputed distance matrix.
+ * Performs radius search for a single point using a precomputed search grid.
  * point_index: reference point
  * indices: indices of near points
- * sqr_distances: distance matrix
- * total_points: number of points in the cloud
+ * points: points the grid has been built from
+ * grid: search grid
  * return: the number of near points
  */
 int radiusSearch(
-	const int point_index, std::vector<int> & indices, const bool* sqr_distances, int total_points)
+	const int point_index, std::vector<int> & indices, const std::vector<Point> &points, const RadiusSearchGrid& grid)
 {
 	indices.clear();
-	for (int i = 0; i < point_index; i++) {
-		if (sqr_distances[point_index*total_points + i]) {
-			indices.push_back(i);
-		}
-	}
-	for (int i = point_index + 1; i < total_points; i++) {
-		if (sqr_distances[point_index*total_points + i]) {
-			indices.push_back(i);
+	const Point& p = points[point_index];
+	const int64_t* cell = &grid.point_cell[3*point_index];
+	int64_t x_begin = std::max(cell[0] - 1, (int64_t)0);
+	int64_t x_end = std::min(cell[0] + 1, grid.dim_x - 1);
+	// test the surrounding cells
+	for (int64_t z = std::max(cell[2] - 1, (int64_t)0); z <= std::min(cell[2] + 1, grid.dim_z - 1); z++)
+		for (int64_t y = std::max(cell[1] - 1, (int64_t)0); y <= std::min(cell[1] + 1, grid.dim_y - 1); y++)
+		{
+			// cells along the x axis are adjacent in the key order
+			int64_t first_key = linearizeCell(grid, x_begin, y, z);
+			int64_t last_key = linearizeCell(grid, x_end, y, z);
+			size_t c = std::lower_bound(grid.cell_keys.begin(), grid.cell_keys.end(), first_key) - grid.cell_keys.begin();
+			for (; c < grid.cell_keys.size() && grid.cell_keys[c] <= last_key; c++)
+				for (int k = grid.cell_start[c]; k < grid.cell_start[c + 1]; k++)
+				{
+					int i = grid.point_order[k];
+					float dx = points[i].x - p.x;
+					float dy = points[i].y - p.y;
+					float dz = points[i].z - p.z;
+					float sqr_distance = dx*dx + dy*dy + dz*dz;
+					if (i != point_index && sqr_distance <= grid.radius_sqr)
+						indices.push_back(i);
+				}
 		}
-	}
 	return indices.size();
 }
 
@@ -555,25 +601,26 @@ int radiusSearch(
  * Finds all clusters in the given point cloud that are conformant to the given parameters.
  * cloud: point cloud to cluster
  * tolerance: search radius around a single point
- * clusters: list of resulting clusters
+ * buffer: search storage and resulting clusters
  * min_pts_per_cluster: lower cluster size restriction
  * max_pts_per_cluster: higher cluster size restriction
  */
 void extractEuclideanClusters (
 	const PointCloud &cloud, 
-	float tolerance, std::vector<PointIndices> &clusters,
+	float tolerance, ClusteringBuffer& buffer,
 	unsigned int min_pts_per_cluster, 
 	unsigned int max_pts_per_cluster)
 {
 	int nn_start_idx = 0;
 
 	// indicates the processed status for each point
-	std::vector<bool> processed (cloud.size(), false);
+	std::vector<bool>& processed = buffer.processed;
+	processed.assign(cloud.size(), false);
 	// temporary radius search results
-	std::vector<int> nn_indices;
-	// precompute the distance matrix
-	bool *sqr_distances;
-	initRadiusSearch(cloud, &sqr_distances, tolerance);
+	std::vector<int>& nn_indices = buffer.nn_indices;
+	// sort the points into the search grid
+	RadiusSearchGrid& grid = buffer.grid;
+	initRadiusSearch(cloud, grid, tolerance);
 
 	// iterate for all points in the cloud
 	for (int i = 0; i < cloud.size(); ++i)
@@ -582,15 +629,16 @@ void extractEuclideanClusters (
 		if (processed[i])
 			continue;
 		// begin a cluster candidate with one item
-		std::vector<int> seed_queue;
-		int sq_idx = 0;
+		std::vector<int>& seed_queue = buffer.seed_queue;
+		seed_queue.clear();
+		size_t sq_idx = 0;
 		seed_queue.push_back(i);
 		processed[i] = true;
 		
 		// grow the cluster candidate until all items have been searched through
 		while (sq_idx < seed_queue.size())
 		{
-			int ret = radiusSearch(seed_queue[sq_idx], nn_indices, sqr_distances, cloud.size());
+			int ret = radiusSearch(seed_queue[sq_idx], nn_indices, cloud, grid);
 			if (!ret)
 			{
 				sq_idx++;
@@ -610,40 +658,66 @@ void extractEuclideanClusters (
 		// add cluster candidate of fitting size to the resulting clusters
 		if (seed_queue.size() >= min_pts_per_cluster && seed_queue.size() <= max_pts_per_cluster)
 		{
-			PointIndices r;
-			r.indices.resize(seed_queue.size ());
-			for (size_t j = 0; j < seed_queue.size (); ++j)
-				r.indices[j] = seed_queue[j];
-			std::sort (r.indices.begin (), r.indices.end ());
-			clusters.push_back(r);
+			std::vector<int>& indices = buffer.cluster_indices;
+			size_t start = indices.size();
+			indices.insert(indices.end(), seed_queue.begin(), seed_queue.end());
+			std::sort (indices.begin () + start, indices.end ());
+			buffer.clusters.push_back({ start, seed_queue.size() });
 		}
 	}
-	free(sqr_distances);
 }
 
 /**
  * Helper function that compares cluster sizes.
  */
-inline bool comparePointClusters (const PointIndices &a, const PointIndices &b)
+inline bool comparePointClusters (const ClusterRange &a, const ClusterRange &b)
 {
-	return (a.indices.size () < b.indices.size ());
+	return (a.size < b.size);
 }
 
 /**
  * Computes euclidean clustering and sorts the resulting clusters.
+ * The clusters are stored in buffer.clusters.
  */
-void extract (const PointCloud *input_, std::vector<PointIndices> &clusters, double cluster_tolerance_)
+void extract (const PointCloud *input_, ClusteringBuffer& buffer, double cluster_tolerance_)
 {
+	buffer.cluster_indices.clear();
+	buffer.clusters.clear();
 	if (input_->empty())
-	{
-		clusters.clear ();
 		return;
-	}
 	// Send the input dataset to the spatial locator
-	extractEuclideanClusters (*input_, static_cast<float> (cluster_tolerance_), clusters,
+	extractEuclideanClusters (*input_, static_cast<float> (cluster_tolerance_), buffer,
 		_cluster_size_min, _cluster_size_max );
 	// Sort the clusters based on their size (largest one first)
-	std::sort (clusters.rbegin (), clusters.rend (), comparePointClusters);
+	std::sort (buffer.clusters.rbegin (), buffer.clusters.rend (), comparePointClusters);
+}
+
+/**
+ * Stores a rotation around the z axis in a bounding box.
+ * rz: the rotation angle in radians
+ */
+inline void setYaw(Boundingbox& bounding_box, double rz)
+{
+	// quaternion for rotation stored in bounding box
+	double halfYaw = rz * 0.5;  
+	double cosYaw = cos(halfYaw);
+	double sinYaw = sin(halfYaw);
+	bounding_box.orientation.x = 0.0; //x
+	bounding_box.orientation.y = 0.0; //y
+	bounding_box.orientation.z = sinYaw; //z
+	bounding_box.orientation.w = cosYaw; //w, formerly yzx
+}
+
+/**
+ * Orients a bounding box like the rectangle with minimum area around its cluster.
+ * points: first point of the cluster
+ * n: number of cluster points
+ * bounding_box: the box to rotate
+ * buffer: storage for the convex hull
+ */
+inline void estimatePose(const PointRGB* points, size_t n, Boundingbox& bounding_box, HullBuffer& buffer)
+{
+	setYaw(bounding_box, minAreaRectAngle(points, n, buffer) * PI / 180.0);
 }
 
 /**
@@ -654,56 +728,60 @@ void euclidean_clustering::clusterAndColor(
 	PointCloudRGB *out_cloud_ptr,
 	BoundingboxArray* in_out_boundingbox_array,
 	Centroid* in_out_centroids,
+	ClusteringBuffer& buffer,
 	double in_max_cluster_distance=0.5)
 {
-	std::vector<PointIndices> cluster_indices;
-	
 	// perform expensive radius search
-	extract (in_cloud_ptr, cluster_indices, in_max_cluster_distance);
+	extract (in_cloud_ptr, buffer, in_max_cluster_distance);
+
+	// the colored clusters are written to the output cloud one after another
+	out_cloud_ptr->reserve(out_cloud_ptr->size() + buffer.cluster_indices.size());
+	// accepted clusters, their pose is estimated after all clusters have been written
+	std::vector<ClusterSpan>& pose_spans = buffer.pose_spans;
+	pose_spans.clear();
 
-	// color the clusters
-	int j = 0;
-	unsigned int k = 0;
-	for (auto it = cluster_indices.begin(); it != cluster_indices.end(); ++it)
+	for (auto it = buffer.clusters.begin(); it != buffer.clusters.end(); ++it)
 	{
-		PointCloudRGB *current_cluster = new PointCloudRGB;//coord + color cluster
-		//assign color to each cluster
+		const int* cluster_indices = buffer.cluster_indices.data() + it->start;
+		// part of the output cloud that holds the current cluster
+		size_t cluster_start = out_cloud_ptr->size();
+		size_t cluster_size = it->size;
+		out_cloud_ptr->resize(cluster_start + cluster_size);
+		PointRGB* current_cluster = out_cloud_ptr->data() + cluster_start;
+
 		PointDouble centroid = {0.0, 0.0, 0.0};
-		for (auto pit = it->indices.begin(); pit != it->indices.end(); ++pit)
+		// minimum and maximum extends
+		float min_x=std::numeric_limits<float>::max();float max_x=-std::numeric_limits<float>::max();
+		float min_y=std::numeric_limits<float>::max();float max_y=-std::numeric_limits<float>::max();
+		float min_z=std::numeric_limits<float>::max();float max_z=-std::numeric_limits<float>::max();
+		// color the cluster and measure it in a single pass
+		for (size_t i = 0; i < cluster_size; i++)
 		{
-			// fill new colored cluster point by point
-			PointRGB p;
-			p.x = (*in_cloud_ptr)[*pit].x;
-			p.y = (*in_cloud_ptr)[*pit].y;
-			p.z = (*in_cloud_ptr)[*pit].z;
+			const Point& point = (*in_cloud_ptr)[cluster_indices[i]];
+			PointRGB& p = current_cluster[i];
+			p.x = point.x;
+			p.y = point.y;
+			p.z = point.z;
 			p.r = 10;
 			p.g = 20;
 			p.b = 30;
 
-			centroid.x += (*in_cloud_ptr)[*pit].x;
-			centroid.y += (*in_cloud_ptr)[*pit].y;
-			centroid.z += (*in_cloud_ptr)[*pit].z;
+			centroid.x += point.x;
+			centroid.y += point.y;
+			centroid.z += point.z;
 
-			current_cluster->push_back(p);
+			if(p.x<min_x)  min_x = p.x;
+			if(p.y<min_y)  min_y = p.y;
+			if(p.z<min_z)  min_z = p.z;
+			if(p.x>max_x)  max_x = p.x;
+			if(p.y>max_y)  max_y = p.y;
+			if(p.z>max_z)  max_z = p.z;
 		}
 		// centroid from mean
-		centroid.x /= it->indices.size();
-		centroid.y /= it->indices.size();
-		centroid.z /= it->indices.size();
+		centroid.x /= cluster_size;
+		centroid.y /= cluster_size;
+		centroid.z /= cluster_size;
 
-		// minimum and maximum extends
-		float min_x=std::numeric_limits<float>::max();float max_x=-std::numeric_limits<float>::max();
-		float min_y=std::numeric_limits<float>::max();float max_y=-std::numeric_limits<float>::max();
-		float min_z=std::numeric_limits<float>::max();float max_z=-std::numeric_limits<float>::max();
-		for(unsigned int i=0; i<current_cluster->size();i++)
-		{
-			if((*current_cluster)[i].x<min_x)  min_x = (*current_cluster)[i].x;
-			if((*current_cluster)[i].y<min_y)  min_y = (*current_cluster)[i].y;
-			if((*current_cluster)[i].z<min_z)  min_z = (*current_cluster)[i].z;
-			if((*current_cluster)[i].x>max_x)  max_x = (*current_cluster)[i].x;
-			if((*current_cluster)[i].y>max_y)  max_y = (*current_cluster)[i].y;
-			if((*current_cluster)[i].z>max_z)  max_z = (*current_cluster)[i].z;
-		}
 		float l = max_x - min_x;
 		float w = max_y - min_y;
 		float h = max_z - min_z;
@@ -717,43 +795,21 @@ void euclidean_clustering::clusterAndColor(
 		bounding_box.dimensions.y = ((w<0)?-1*w:w);
 		bounding_box.dimensions.z = ((h<0)?-1*h:h);
 
-		double rz = 0;
-		// estimate pose
-		if (_pose_estimation) 
-		{
-			std::vector<Point2D> inner_points;
-			for (unsigned int i=0; i<current_cluster->size(); i++)
-			{
-				Point2D ip;
-				ip.x = ((*current_cluster)[i].x + fabs(min_x))*8;
-				ip.y = ((*current_cluster)[i].y + fabs(min_y))*8;
-				inner_points.push_back(ip);
-			}
-			if (inner_points.size() > 0)
-			{
-				rz = minAreaRectAngle(inner_points) * PI / 180.0;
-			}
-		}
-
-		// quaternion for rotation stored in bounding box
-		double halfYaw = rz * 0.5;  
-		double cosYaw = cos(halfYaw);
-		double sinYaw = sin(halfYaw);
-		bounding_box.orientation.x = 0.0; //x
-		bounding_box.orientation.y = 0.0; //y
-		bounding_box.orientation.z = sinYaw; //z
-		bounding_box.orientation.w = cosYaw; //w, formerly yzx
-
 		if (bounding_box.dimensions.x >0 && bounding_box.dimensions.y >0 && bounding_box.dimensions.z > 0 &&
 			bounding_box.dimensions.x < 15 && bounding_box.dimensions.y >0 && bounding_box.dimensions.y < 15 &&
 			max_z > -1.5 && min_z > -1.5 && min_z < 1.0 )
 		{
+			setYaw(bounding_box, 0.0);
+			if (_pose_estimation)
+				pose_spans.push_back({ cluster_start, cluster_size, in_out_boundingbox_array->boxes.size() });
 			in_out_boundingbox_array->boxes.push_back(bounding_box);
 			in_out_centroids->points.push_back(centroid);
 		}
-		out_cloud_ptr->insert(out_cloud_ptr->end(), current_cluster->begin(), current_cluster->end());
-		j++; k++;
 	}
+	// estimate the poses one after another with the same buffers
+	for (const ClusterSpan& span : pose_spans)
+		estimatePose(out_cloud_ptr->data() + span.start, span.size,
+			in_out_boundingbox_array->boxes[span.box], buffer.hull);
 }
 /**
  * Segments the cloud into categories representing distance ranges from the origin
@@ -765,20 +821,17 @@ void euclidean_clustering::clusterAndColor(
  * in_max_cluster_distance: distance threshold
  */
 void euclidean_clustering::segmentByDistance(
-	const PointCloud *in_cloud_ptr,
+	const PointCloudView *in_cloud_ptr,
 	PointCloudRGB *out_cloud_ptr,
 	BoundingboxArray *out_boundingbox_array,
 	Centroid *in_out_centroids,
 	double in_max_cluster_distance=0.5)
 {
-	PointCloud*   cloud_segments_array[5];
+	// the categories of the previous point cloud are overwritten, their storage is kept
+	for (unsigned int i=0; i<5; i++)
+		cloud_segments_array[i].clear();
 	double thresholds[5] = {0.5, 1.1, 1.6, 2.3, 2.6f};
 
-	for(unsigned int i=0; i<5; i++)
-	{
-		PointCloud *tmp_cloud = new PointCloud;
-		cloud_segments_array[i] = tmp_cloud;
-	}
 	for (unsigned int i=0; i<in_cloud_ptr->size(); i++)
 	{
 		Point current_point;
@@ -789,44 +842,38 @@ void euclidean_clustering::segmentByDistance(
 		// categorize by distance from origin
 		float origin_distance = sqrt(current_point.x*current_point.x + current_point.y*current_point.y);
 		if (origin_distance < 15 ) { 
-			cloud_segments_array[0]->push_back (current_point);
+			cloud_segments_array[0].push_back (current_point);
 		}
 		else if(origin_distance < 30) {
-			cloud_segments_array[1]->push_back (current_point);
+			cloud_segments_array[1].push_back (current_point);
 		}
 		else if(origin_distance < 45) {
-			cloud_segments_array[2]->push_back (current_point);
+			cloud_segments_array[2].push_back (current_point);
 		}
 		else if(origin_distance < 60) {
-			cloud_segments_array[3]->push_back (current_point);
+			cloud_segments_array[3].push_back (current_point);
 		} else {
-			cloud_segments_array[4]->push_back (current_point);
+			cloud_segments_array[4].push_back (current_point);
 		}
 	}
 	// perform clustering and coloring on the individual categories
 	for(unsigned int i=0; i<5; i++)
 	{
-		clusterAndColor(cloud_segments_array[i], out_cloud_ptr, out_boundingbox_array, in_out_centroids, thresholds[i]);
+		clusterAndColor(&cloud_segments_array[i], out_cloud_ptr, out_boundingbox_array, in_out_centroids,
+			clustering_buffer, thresholds[i]);
 	}
 }
 
 /**
  * Reads the next point cloud.
+ * The resulting cloud refers to the mapped input file.
  */
-void parsePointCloud(std::ifstream& input_file, PointCloud *cloud)
+void parsePointCloud(mapped_file& input_file, PointCloudView *cloud)
 {
-	int size = 0;
-	Point p;
-	input_file.read((char*)&(size), sizeof(int));
 	try {
-		for (int i = 0; i < size; i++)
-		{
-			input_file.read((char*)&p.x, sizeof(float));
-			input_file.read((char*)&p.y, sizeof(float));
-			input_file.read((char*)&p.z, sizeof(float));
-			cloud->push_back(p);
-		}
-	} catch (std::ifstream::failure) {
+		int32_t size = input_file.read<int32_t>();
+		*cloud = input_file.read_array<Point>(size);
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading point cloud");
 	}
 }
@@ -834,136 +881,193 @@ void parsePointCloud(std::ifstream& input_file, PointCloud *cloud)
 /**
  * Reads the next reference cloud result.
  */
-void parseOutCloud(std::ifstream& input_file, PointCloudRGB *cloud)
+void parseOutCloud(mapped_file& output_file, PointCloudRGB *cloud)
 {
-    int size = 0;
-    PointRGB p;
-    try {
-	input_file.read((char*)&(size), sizeof(int));
-
-	for (int i = 0; i < size; i++)
-	    {
-		input_file.read((char*)&p.x, sizeof(float));
-		input_file.read((char*)&p.y, sizeof(float));
-		input_file.read((char*)&p.z, sizeof(float));
-		input_file.read((char*)&p.r, sizeof(uint8_t));
-		input_file.read((char*)&p.g, sizeof(uint8_t));
-		input_file.read((char*)&p.b, sizeof(uint8_t));				    
-		cloud->push_back(p);
-	    }
-    }  catch (std::ifstream::failure) {
+	try {
+		int32_t size = output_file.read<int32_t>();
+		cloud->resize(size);
+		for (int i = 0; i < size; i++)
+		{
+			PointRGB& p = (*cloud)[i];
+			p.x = output_file.read<float>();
+			p.y = output_file.read<float>();
+			p.z = output_file.read<float>();
+			p.r = output_file.read<uint8_t>();
+			p.g = output_file.read<uint8_t>();
+			p.b = output_file.read<uint8_t>();
+		}
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading reference cloud");
-    } 
+	}
 }
 
 /**
  * Reads the next reference bounding boxes.
  */
-void parseBoundingboxArray(std::ifstream& input_file, BoundingboxArray *bb_array)
+void parseBoundingboxArray(mapped_file& output_file, BoundingboxArray *bb_array)
 {
-    int size = 0;
-    Boundingbox bba;
-    try {
-		input_file.read((char*)&(size), sizeof(int));
+	try {
+		int32_t size = output_file.read<int32_t>();
+		bb_array->boxes.resize(size);
 		for (int i = 0; i < size; i++)
 		{
-			input_file.read((char*)&bba.position.x, sizeof(double));
-			input_file.read((char*)&bba.position.y, sizeof(double));
-			input_file.read((char*)&bba.orientation.x, sizeof(double));
-			input_file.read((char*)&bba.orientation.y, sizeof(double));
-			input_file.read((char*)&bba.orientation.z, sizeof(double));
-			input_file.read((char*)&bba.orientation.w, sizeof(double));
-			input_file.read((char*)&bba.dimensions.x, sizeof(double));
-			input_file.read((char*)&bba.dimensions.y, sizeof(double));
-			bb_array->boxes.push_back(bba);
-	    }
-    }  catch (std::ifstream::failure) {
+			Boundingbox& bba = bb_array->boxes[i];
+			bba.position.x = output_file.read<double>();
+			bba.position.y = output_file.read<double>();
+			bba.orientation.x = output_file.read<double>();
+			bba.orientation.y = output_file.read<double>();
+			bba.orientation.z = output_file.read<double>();
+			bba.orientation.w = output_file.read<double>();
+			bba.dimensions.x = output_file.read<double>();
+			bba.dimensions.y = output_file.read<double>();
+		}
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading reference bounding boxes");
-    }
+	}
 }
 
 /*
  * Reads the next reference centroids.
  */
-void parseCentroids(std::ifstream& input_file, Centroid *centroids)
+void parseCentroids(mapped_file& output_file, Centroid *centroids)
 {
-	int size = 0;
-	PointDouble p;
 	try {
-		input_file.read((char*)&(size), sizeof(int));
+		int32_t size = output_file.read<int32_t>();
+		centroids->points.resize(size);
 		for (int i = 0; i < size; i++)
 		{
-			input_file.read((char*)&p.x, sizeof(double));
-			input_file.read((char*)&p.y, sizeof(double));
-			input_file.read((char*)&p.z, sizeof(double));
-			centroids->points.push_back(p);
+			PointDouble& p = centroids->points[i];
+			p.x = output_file.read<double>();
+			p.y = output_file.read<double>();
+			p.z = output_file.read<double>();
 		}
-	} catch (std::ifstream::failure) {
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading reference centroids");
 	}
 }
 
-int euclidean_clustering::read_next_testcases(int count)
+/**
+ * Records the start of every testcase in the input and reference data files.
+ */
+void indexTestcases(mapped_file& input_file, mapped_file& output_file, int testcases)
+{
+	for (int i = 0; i < testcases; i++)
+	{
+		try {
+			input_file.add_testcase();
+			int32_t size = input_file.read<int32_t>();
+			input_file.skip(size*sizeof(Point));
+		} catch (const std::ios_base::failure&) {
+			throw std::ios_base::failure("Error indexing the input data file");
+		}
+		try {
+			output_file.add_testcase();
+			// colored cloud: coordinates and color
+			int32_t size = output_file.read<int32_t>();
+			output_file.skip(size*(3*sizeof(float) + 3*sizeof(uint8_t)));
+			// bounding boxes: eight coordinates
+			size = output_file.read<int32_t>();
+			output_file.skip(size*8*sizeof(double));
+			// centroids
+			size = output_file.read<int32_t>();
+			output_file.skip(size*3*sizeof(double));
+		} catch (const std::ios_base::failure&) {
+			throw std::ios_base::failure("Error indexing the output data file");
+		}
+	}
+}
+
+void euclidean_clustering::free_batch(TestcaseBatch& batch)
+{
+	batch.in_cloud_ptr.release();
+	batch.out_cloud_ptr.release();
+	batch.out_boundingbox_array.release();
+	batch.out_centroids.release();
+	batch.count = 0;
+}
+
+int euclidean_clustering::read_batch(TestcaseBatch& batch, int count)
 {
 	int i;
-	// free previously allocated memory
-	delete [] in_cloud_ptr;
-	delete [] out_cloud_ptr;
-	delete [] out_boundingbox_array;
-	delete [] out_centroids;
-	// allocate new memory for the current case
-	in_cloud_ptr = new PointCloud[count];
-	out_cloud_ptr = new PointCloudRGB[count];
-	out_boundingbox_array = new BoundingboxArray[count];
-	out_centroids = new Centroid[count];
+	// reuse the memory of the previous step
+	// and only allocate new if more testcases are read at once
+	batch.in_cloud_ptr.acquire(count);
+	batch.out_cloud_ptr.acquire(count);
+	batch.out_boundingbox_array.acquire(count);
+	batch.out_centroids.acquire(count);
+	batch.first = read_testcases;
 	// read the testcase data
 	for (i = 0; (i < count) && (read_testcases < testcases); i++,read_testcases++)
 	{
 		try {
-			parsePointCloud(input_file, in_cloud_ptr + i);
-		} catch (std::ios_base::failure& e) {
+			input_file.seek_testcase(read_testcases);
+			parsePointCloud(input_file, &batch.in_cloud_ptr[i]);
+		} catch (const std::ios_base::failure& e) {
 			std::cerr << e.what() << std::endl;
 			exit(-3);
 		}
 	}
-	return i;
+	batch.count = i;
+	// the results of the previous step are overwritten, their storage is kept
+	for (i = 0; i < batch.count; i++)
+	{
+		batch.out_cloud_ptr[i].clear();
+		batch.out_boundingbox_array[i].boxes.clear();
+		batch.out_centroids[i].points.clear();
+	}
+	return batch.count;
+}
+
+int euclidean_clustering::read_next_testcases(int count)
+{
+	return read_batch(current_batch, count);
 }
 
 void euclidean_clustering::init() {
 	std::cout << "init\n";
-	// try to open input and output file streams
-	input_file.exceptions ( std::ifstream::failbit | std::ifstream::badbit );
-	output_file.exceptions ( std::ifstream::failbit | std::ifstream::badbit );
+	// try to map the input and output files
 	try {
-		input_file.open("../../../data/ec_input.dat", std::ios::binary);
-	} catch (std::ifstream::failure) {
+		input_file.open("../../../data/ec_input.dat");
+	} catch (const std::ios_base::failure&) {
 		std::cerr << "Error opening the input data file" << std::endl;
 		exit(-3);
 	}
 	try {
-		output_file.open("../../../data/ec_output.dat", std::ios::binary);
-	}  catch (std::ifstream::failure) {
+		output_file.open("../../../data/ec_output.dat");
+	}  catch (const std::ios_base::failure&) {
 		std::cerr << "Error opening the output data file" << std::endl;
 		exit(-3);
 	}
 	// consume the number of testcases from the input file
+	// and find the start of every testcase
 	try {
 		testcases = read_number_testcases(input_file);
-	} catch (std::ios_base::failure& e) {
+		indexTestcases(input_file, output_file, testcases);
+	} catch (const std::ios_base::failure& e) {
 		std::cerr << e.what() << std::endl;
 		exit(-3);
 	}
 	// prepare for the first iteration
 	error_so_far = false;
 	max_delta = 0.0;
-	in_cloud_ptr = nullptr;
-	out_cloud_ptr = nullptr;
-	out_boundingbox_array = nullptr;
-	out_centroids = nullptr;
+	free_batch(current_batch);
 
 	std::cout << "done\n" << std::endl;
 }
 
+void euclidean_clustering::compute_batch(TestcaseBatch& batch)
+{
+	for (int i = 0; i < batch.count; i++)
+	{
+		// actual kernel invocation
+		segmentByDistance(&batch.in_cloud_ptr[i],
+				&batch.out_cloud_ptr[i],
+				&batch.out_boundingbox_array[i],
+				&batch.out_centroids[i]);
+		testcase_func();
+	}
+}
+
 void euclidean_clustering::run(int p) {
 	// prepare reading the first testcases
 	pause_func();
@@ -971,23 +1075,36 @@ void euclidean_clustering::run(int p) {
 	while (read_testcases < testcases)
 	{
 		// read the next input data
-		int count = read_next_testcases(p);
+		read_next_testcases(p);
 		// execute the algorithm
 		unpause_func();
-		for (int i = 0; i < count; i++)
-		{
-			// actual kernel invocation
-			segmentByDistance(&in_cloud_ptr[i],
-					&out_cloud_ptr[i],
-					&out_boundingbox_array[i],
-					&out_centroids[i]);
-		}
+		compute_batch(current_batch);
 		// pause the timer, then read and compare with the reference data
 		pause_func();
-		check_next_outputs(count);
+		check_next_outputs();
 	}
 }
 
+void euclidean_clustering::run_pipelined(int p) {
+	// only the computation stage is measured
+	pause_func();
+	TestcaseBatch batches[PIPELINE_BATCHES];
+	run_pipeline(batches, PIPELINE_BATCHES,
+		[this, p](TestcaseBatch& batch) {
+			return read_batch(batch, p) > 0;
+		},
+		[this](TestcaseBatch& batch) {
+			unpause_func();
+			compute_batch(batch);
+			pause_func();
+		},
+		[this](TestcaseBatch& batch) {
+			check_batch(batch);
+		});
+	for (int i = 0; i < PIPELINE_BATCHES; i++)
+		free_batch(batches[i]);
+}
+
 /**
  * Helper function for point comparison
  */
@@ -1034,20 +1151,22 @@ inline bool compareBBs (const Boundingbox &a, const Boundingbox &b)
 			return (a.dimensions.y < b.dimensions.y);
 }
 
-void euclidean_clustering::check_next_outputs(int count)
+void euclidean_clustering::check_next_outputs()
 {
-	PointCloudRGB reference_out_cloud;
-	BoundingboxArray reference_bb_array;
-	Centroid reference_centroids;
-	
-	for (int i = 0; i < count; i++)
+	check_batch(current_batch);
+}
+
+void euclidean_clustering::check_batch(TestcaseBatch& batch)
+{
+	for (int i = 0; i < batch.count; i++)
 	{
 		// read the reference result
 		try {
+			output_file.seek_testcase(batch.first + i);
 			parseOutCloud(output_file, &reference_out_cloud);
 			parseBoundingboxArray(output_file, &reference_bb_array);
 			parseCentroids(output_file, &reference_centroids);
-		} catch (std::ios_base::failure& e) {
+		} catch (const std::ios_base::failure& e) {
 			std::cerr << e.what() << std::endl;
 			exit(-3);
 		}
@@ -1055,23 +1174,23 @@ void euclidean_clustering::check_next_outputs(int count)
 		// as the result is still right when points/boxes/centroids are in different order,
 		// we sort the result and reference to normalize it and we can compare it
 		std::sort(reference_out_cloud.begin(), reference_out_cloud.end(), compareRGBPoints);
-		std::sort(out_cloud_ptr[i].begin(), out_cloud_ptr[i].end(), compareRGBPoints);
+		std::sort(batch.out_cloud_ptr[i].begin(), batch.out_cloud_ptr[i].end(), compareRGBPoints);
 		std::sort(reference_bb_array.boxes.begin(), reference_bb_array.boxes.end(), compareBBs);
-		std::sort(out_boundingbox_array[i].boxes.begin(), out_boundingbox_array[i].boxes.end(), compareBBs);
+		std::sort(batch.out_boundingbox_array[i].boxes.begin(), batch.out_boundingbox_array[i].boxes.end(), compareBBs);
 		std::sort(reference_centroids.points.begin(), reference_centroids.points.end(), comparePoints);
-		std::sort(out_centroids[i].points.begin(), out_centroids[i].points.end(), comparePoints);
+		std::sort(batch.out_centroids[i].points.begin(), batch.out_centroids[i].points.end(), comparePoints);
 		// test for size differences
-		if (reference_out_cloud.size() != out_cloud_ptr[i].size())
+		if (reference_out_cloud.size() != batch.out_cloud_ptr[i].size())
 		{
 			error_so_far = true;
 			continue;
 		}
-		if (reference_bb_array.boxes.size() != out_boundingbox_array[i].boxes.size())
+		if (reference_bb_array.boxes.size() != batch.out_boundingbox_array[i].boxes.size())
 		{
 			error_so_far = true;
 			continue;
 		}
-		if (reference_centroids.points.size() != out_centroids[i].points.size())
+		if (reference_centroids.points.size() != batch.out_centroids[i].points.size())
 		{
 			error_so_far = true;
 			continue;
@@ -1079,24 +1198,24 @@ void euclidean_clustering::check_next_outputs(int count)
 		// test for content divergence
 		for (int j = 0; j < reference_out_cloud.size(); j++)
 		{
-			max_delta = std::fmax(std::abs(out_cloud_ptr[i][j].x - reference_out_cloud[j].x), max_delta);
-			max_delta = std::fmax(std::abs(out_cloud_ptr[i][j].y - reference_out_cloud[j].y), max_delta);
-			max_delta = std::fmax(std::abs(out_cloud_ptr[i][j].z - reference_out_cloud[j].z), max_delta);
+			max_delta = std::fmax(std::abs(batch.out_cloud_ptr[i][j].x - reference_out_cloud[j].x), max_delta);
+			max_delta = std::fmax(std::abs(batch.out_cloud_ptr[i][j].y - reference_out_cloud[j].y), max_delta);
+			max_delta = std::fmax(std::abs(batch.out_cloud_ptr[i][j].z - reference_out_cloud[j].z), max_delta);
 		}
 		for (int j = 0; j < reference_bb_array.boxes.size(); j++)
 		{
-			max_delta = std::fmax(std::abs(out_boundingbox_array[i].boxes[j].position.x - reference_bb_array.boxes[j].position.x), max_delta);		    
-			max_delta = std::fmax(std::abs(out_boundingbox_array[i].boxes[j].position.y - reference_bb_array.boxes[j].position.y), max_delta);
-			max_delta = std::fmax(std::abs(out_boundingbox_array[i].boxes[j].dimensions.x - reference_bb_array.boxes[j].dimensions.x), max_delta);		    
-			max_delta = std::fmax(std::abs(out_boundingbox_array[i].boxes[j].dimensions.y - reference_bb_array.boxes[j].dimensions.y), max_delta); 
-			max_delta = std::fmax(std::abs(out_boundingbox_array[i].boxes[j].orientation.x - reference_bb_array.boxes[j].orientation.x), max_delta);
-			max_delta = std::fmax(std::abs(out_boundingbox_array[i].boxes[j].orientation.y - reference_bb_array.boxes[j].orientation.y), max_delta);			
+			max_delta = std::fmax(std::abs(batch.out_boundingbox_array[i].boxes[j].position.x - reference_bb_array.boxes[j].position.x), max_delta);		    
+			max_delta = std::fmax(std::abs(batch.out_boundingbox_array[i].boxes[j].position.y - reference_bb_array.boxes[j].position.y), max_delta);
+			max_delta = std::fmax(std::abs(batch.out_boundingbox_array[i].boxes[j].dimensions.x - reference_bb_array.boxes[j].dimensions.x), max_delta);		    
+			max_delta = std::fmax(std::abs(batch.out_boundingbox_array[i].boxes[j].dimensions.y - reference_bb_array.boxes[j].dimensions.y), max_delta); 
+			max_delta = std::fmax(std::abs(batch.out_boundingbox_array[i].boxes[j].orientation.x - reference_bb_array.boxes[j].orientation.x), max_delta);
+			max_delta = std::fmax(std::abs(batch.out_boundingbox_array[i].boxes[j].orientation.y - reference_bb_array.boxes[j].orientation.y), max_delta);			
 		}
 		for (int j = 0; j < reference_centroids.points.size(); j++)
 		{
-			max_delta = std::fmax(std::abs(out_centroids[i].points[j].x - reference_centroids.points[j].x), max_delta);
-			max_delta = std::fmax(std::abs(out_centroids[i].points[j].y - reference_centroids.points[j].y), max_delta);
-			max_delta = std::fmax(std::abs(out_centroids[i].points[j].z - reference_centroids.points[j].z), max_delta);
+			max_delta = std::fmax(std::abs(batch.out_centroids[i].points[j].x - reference_centroids.points[j].x), max_delta);
+			max_delta = std::fmax(std::abs(batch.out_centroids[i].points[j].y - reference_centroids.points[j].y), max_delta);
+			max_delta = std::fmax(std::abs(batch.out_centroids[i].points[j].z - reference_centroids.points[j].z), max_delta);
 		}
 		// finishing steps for the next iteration
 		reference_bb_array.boxes.clear();
@@ -25,19 +25,32 @@ public:
 	 */
 	virtual void run(int p = 1) = 0;
 
+	/**
+	 * Executes the testcases in blocks of p at a time like run(), but reads the next block
+	 * and compares the previous block while the current one is processed.
+	 * Kernels without a pipelined implementation use run() instead.
+	 * p: the number of testcases to process
+	 */
+	virtual void run_pipelined(int p = 1) {
+		run(p);
+	}
+
 	/**
 	 * Compares the computed output with the reference data.
 	 */
 	virtual bool check_output() = 0;
 
 	/* 
-	 * Sets the functions to call for pausing and resuming runtime measurement.
+	 * Sets the functions to call for pausing and resuming runtime measurement
+	 * and for marking the end of a testcase.
 	 */
 	void set_timer_functions(
 		void (*pause_function)(),
-		void (*unpause_function)()) {
+		void (*unpause_function)(),
+		void (*testcase_function)()) {
 		unpause_func = unpause_function;
 		pause_func = pause_function;
+		testcase_func = testcase_function;
 	}
 
 protected:
@@ -45,6 +58,9 @@ protected:
 	void (*unpause_func)();
 	// the function to call for pausing runtime measurement
 	void (*pause_func)();
+	// the function to call after each testcase while the runtime is measured,
+	// records the time since resuming or since the previous call as testcase duration
+	void (*testcase_func)();
 	
 	/**
 	 * Reads the next testcases.
@@ -0,0 +1,107 @@
+/**
+ * Author:  Florian Stock, Technische Universität Darmstadt,
+ * Embedded Systems & Applications Group 2018
+ * License: Apache 2.0 (see attachached File)
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// number of testcase batches in flight during a pipelined run,
+// one for each of the reading, computation and comparison stages
+#define PIPELINE_BATCHES 3
+
+/**
+ * Queue with limited capacity that passes elements between threads.
+ */
+template<typename T>
+class bounded_queue {
+public:
+	bounded_queue(size_t capacity) : capacity(capacity) {}
+	/**
+	 * Appends an element. Waits while the queue is full.
+	 */
+	void push(const T& element) {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this] { return elements.size() < capacity; });
+		elements.push_back(element);
+		not_empty.notify_one();
+	}
+	/**
+	 * Removes the oldest element. Waits while the queue is empty.
+	 * element: receives the removed element
+	 * return: false if the queue has been closed and is empty
+	 */
+	bool pop(T& element) {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this] { return !elements.empty() || closed; });
+		if (elements.empty())
+			return false;
+		element = elements.front();
+		elements.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+	/**
+	 * Indicates that no more elements will be appended.
+	 */
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_empty.notify_all();
+	}
+private:
+	std::mutex mutex;
+	std::condition_variable not_empty, not_full;
+	std::deque<T> elements;
+	size_t capacity;
+	bool closed = false;
+};
+
+/**
+ * Processes testcase batches in three stages that run concurrently:
+ * reading on a reader thread, computation on a compute thread
+ * and comparison with the reference data on the calling thread.
+ * Batches are handed from stage to stage and reused once they have been compared.
+ * batches: batch storage
+ * batch_no: number of batches
+ * read: fills a batch, returns false if no testcases are left
+ * compute: runs the algorithm on a batch
+ * verify: compares the results of a batch
+ */
+template<typename Batch, typename Read, typename Compute, typename Verify>
+void run_pipeline(Batch* batches, int batch_no, Read read, Compute compute, Verify verify)
+{
+	bounded_queue<Batch*> free_batches(batch_no), read_batches(batch_no), computed_batches(batch_no);
+	for (int i = 0; i < batch_no; i++)
+		free_batches.push(batches + i);
+	std::thread reader([&]() {
+		Batch* batch;
+		while (free_batches.pop(batch) && read(*batch))
+			read_batches.push(batch);
+		read_batches.close();
+	});
+	std::thread computer([&]() {
+		Batch* batch;
+		while (read_batches.pop(batch))
+		{
+			compute(*batch);
+			computed_batches.push(batch);
+		}
+		computed_batches.close();
+	});
+	Batch* batch;
+	while (computed_batches.pop(batch))
+	{
+		verify(*batch);
+		free_batches.push(batch);
+	}
+	reader.join();
+	computer.join();
+}
+
+#endif
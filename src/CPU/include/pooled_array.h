@@ -0,0 +1,76 @@
+/**
+ * Author:  Florian Stock, Technische Universität Darmstadt,
+ * Embedded Systems & Applications Group 2018
+ * License: Apache 2.0 (see attachached File)
+ */
+#ifndef POOLED_ARRAY_H
+#define POOLED_ARRAY_H
+
+#include <cstddef>
+#include <utility>
+
+/**
+ * Array that is kept alive between testcase batches.
+ * It is only reallocated when more elements are requested than it holds,
+ * so batches of the same or smaller size do not call the allocator.
+ * Elements that are kept are not reset, which also preserves the storage
+ * of containers inside them.
+ */
+template<typename T>
+class pooled_array {
+public:
+	pooled_array() {}
+	~pooled_array() {
+		delete [] elements;
+	}
+	pooled_array(const pooled_array&) = delete;
+	pooled_array& operator=(const pooled_array&) = delete;
+	pooled_array(pooled_array&& other) {
+		*this = std::move(other);
+	}
+	pooled_array& operator=(pooled_array&& other) {
+		if (this != &other) {
+			delete [] elements;
+			elements = other.elements;
+			capacity = other.capacity;
+			other.elements = nullptr;
+			other.capacity = 0;
+		}
+		return *this;
+	}
+
+	/**
+	 * Makes at least n elements available.
+	 * Their values are only preserved if no reallocation is necessary.
+	 * return: the first element
+	 */
+	T* acquire(size_t n) {
+		if (n > capacity) {
+			delete [] elements;
+			elements = nullptr;
+			capacity = 0;
+			elements = new T[n];
+			capacity = n;
+		}
+		return elements;
+	}
+	/**
+	 * Frees the elements.
+	 */
+	void release() {
+		delete [] elements;
+		elements = nullptr;
+		capacity = 0;
+	}
+	T* data() { return elements; }
+	const T* data() const { return elements; }
+	T& operator[](size_t i) { return elements[i]; }
+	const T& operator[](size_t i) const { return elements[i]; }
+private:
+	// the allocated elements
+	T* elements = nullptr;
+	// number of allocated elements
+	size_t capacity = 0;
+};
+
+#endif
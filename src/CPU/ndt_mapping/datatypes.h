@@ -8,6 +8,9 @@
 
 #include <vector>
 
+#include "aligned_allocator.h"
+#include "mapped_file.h"
+
 typedef struct PointXYZI {
     float data[4];
 } PointXYZI;
@@ -47,6 +50,8 @@ typedef struct Point4d {
 
 typedef std::vector<PointXYZI> PointCloudSource;
 typedef PointCloudSource PointCloud;
+// point cloud stored in a mapped data file
+typedef mapped_array<PointXYZI> PointCloudView;
 
 typedef struct CallbackResult {
     bool converged;
@@ -60,8 +65,67 @@ typedef struct Voxel {
     int numberPoints;
 } Voxel;
 
+#if defined(EPHOS_VOXEL_COEFFICIENTS_FLOAT) || defined(EPHOS_VOXEL_COEFFICIENTS_DOUBLE)
+#define EPHOS_VOXEL_COEFFICIENTS
+#endif
+#ifdef EPHOS_VOXEL_COEFFICIENTS_FLOAT
+typedef float VoxelCoefficient;
+#else
+typedef double VoxelCoefficient;
+#endif
+
+/**
+ * Compact copy of the gaussian of a voxel that is read during the derivative computation.
+ * The inverse covariance is symmetric, so only its upper triangle is kept.
+ * A record takes 96 bytes with double and 64 bytes with float coefficients.
+ */
+typedef struct alignas(32) VoxelGaussian {
+    VoxelCoefficient mean[3];
+    // inverse covariance entries 00, 11, 22, 01, 02 and 12
+    VoxelCoefficient invCovariance[6];
+} VoxelGaussian;
 
-typedef std::vector<Voxel> VoxelGrid;
+/**
+ * Hash table slot that refers to an occupied voxel.
+ */
+typedef struct VoxelSlot {
+    // linearized index of the voxel in the dense grid, -1 for empty slots
+    int64_t key;
+    // position of the voxel in the cell array
+    int cell;
+} VoxelSlot;
+
+/**
+ * Running sums of the points inside a voxel, kept by the incremental voxel map.
+ */
+typedef struct VoxelSums {
+    Vec3 pointSum;
+    // sum of the outer products of the points
+    Mat33 productSum;
+    int numberPoints;
+    // grid generation the voxel has been finished for, -1 after points have been added
+    int generation;
+} VoxelSums;
+
+/**
+ * Voxel grid that only holds occupied cells.
+ * Cells are found by their linearized index in the dense grid
+ * through an open addressing hash table with linear probing.
+ */
+typedef struct VoxelGrid {
+    // occupied cells
+    std::vector<Voxel> cells;
+    // hash table, the number of slots is a power of two
+    std::vector<VoxelSlot> slots;
+    // number of cells in the dense grid that spans the point cloud
+    size_t dense_size = 0;
+    // running sums of the occupied cells, only used by the incremental voxel map
+    std::vector<VoxelSums> sums;
+    // incremented whenever all finished cells become outdated
+    int generation = 0;
+    // compact gaussians of the occupied cells, only used with EPHOS_VOXEL_COEFFICIENTS
+    std::vector<VoxelGaussian, aligned_allocator<VoxelGaussian, 32>> gaussians;
+} VoxelGrid;
 
 Matrix4f Matrix4f_Identity = {
 	{{1.0, 0.0, 0.0, 0.0},
@@ -0,0 +1,110 @@
+/**
+ * Derives the growing map data set from the ndt_mapping testcases.
+ *
+ * Every testcase of ndt_input.dat is repeated with a map that grows in steps
+ * until it reaches the full map of the testcase. Each of these maps extends the previous one,
+ * so the incremental voxel map continues it instead of rebuilding it.
+ * The extended maps are written with a negative size followed by the added points only,
+ * the kernel appends them to the map of the previous testcase.
+ * The points that span the lower end of the map come first, so that the voxel borders stay in place.
+ * The reference results are computed with the default build, which rebuilds the map every time.
+ * License: Apache 2.0 (see attachached File)
+ */
+#include "datatypes.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+// number of testcases taken from the original data
+#define GROWING_TESTCASES 3
+// number of maps per original testcase, the last one is the full map
+#define GROWING_STEPS 3
+
+/**
+ * Reads a point cloud preceded by its size.
+ */
+PointCloud readCloud(std::ifstream& input)
+{
+	int32_t size;
+	input.read((char*)&size, sizeof(int32_t));
+	PointCloud cloud(size);
+	input.read((char*)cloud.data(), size*sizeof(PointXYZI));
+	return cloud;
+}
+
+/**
+ * Writes a point cloud or part of it preceded by its size.
+ * size: the number of points, negative for the points that extend the previous map
+ */
+void writeCloud(std::ofstream& output, const PointXYZI* points, int32_t size)
+{
+	output.write((char*)&size, sizeof(int32_t));
+	output.write((char*)points, std::abs(size)*sizeof(PointXYZI));
+}
+
+/**
+ * Moves the points with the smallest coordinates to the front of the map.
+ */
+void frontMinimum(PointCloud& map)
+{
+	size_t front = 0;
+	for (int elem = 0; elem < 3; elem++)
+	{
+		PointCloud::iterator minimum = std::min_element(map.begin() + front, map.end(),
+			[elem](const PointXYZI& a, const PointXYZI& b) { return a.data[elem] < b.data[elem]; });
+		// a point already in front may hold the minimum, too
+		bool found = false;
+		for (size_t i = 0; i < front; i++)
+			if (map[i].data[elem] <= minimum->data[elem])
+				found = true;
+		if (!found)
+			std::swap(map[front++], *minimum);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::ifstream input("../../../data/ndt_input.dat", std::ios::binary);
+	std::ofstream output("../../../data/ndt_growing_input.dat", std::ios::binary);
+	if (!input || !output)
+	{
+		std::cerr << "Error opening the data files" << std::endl;
+		return -3;
+	}
+	int32_t testcases;
+	input.read((char*)&testcases, sizeof(int32_t));
+	if (testcases < GROWING_TESTCASES)
+	{
+		std::cerr << "Not enough testcases in ndt_input.dat" << std::endl;
+		return -3;
+	}
+	int32_t growing_testcases = GROWING_TESTCASES*GROWING_STEPS;
+	output.write((char*)&growing_testcases, sizeof(int32_t));
+	for (int i = 0; i < GROWING_TESTCASES; i++)
+	{
+		Matrix4f init_guess;
+		input.read((char*)&init_guess, sizeof(Matrix4f));
+		PointCloud scan = readCloud(input);
+		PointCloud map = readCloud(input);
+		if (!input)
+		{
+			std::cerr << "Error reading ndt_input.dat" << std::endl;
+			return -3;
+		}
+		frontMinimum(map);
+		size_t written = 0;
+		for (int step = 1; step <= GROWING_STEPS; step++)
+		{
+			output.write((char*)&init_guess, sizeof(Matrix4f));
+			writeCloud(output, scan.data(), scan.size());
+			size_t size = map.size()*step/GROWING_STEPS;
+			if (step == 1)
+				writeCloud(output, map.data(), size);
+			else
+				writeCloud(output, map.data() + written, -(int32_t)(size - written));
+			written = size;
+		}
+	}
+	return 0;
+}
@@ -7,28 +7,78 @@
  */
 #include "benchmark.h"
 #include "datatypes.h"
+#include "mapped_file.h"
+#include "pipeline.h"
+#include "pooled_array.h"
+#include "soa_cloud.h"
+#include "solver.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
-#include <fstream>
 #include <limits>
 #include <cstring>
 #include <chrono>
+#ifdef EPHOS_CAPTURE_SYSTEMS
+#include <fstream>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define EPHOS_X86_SIMD
+#endif
 
 // maximum allowed deviation from reference
 #define MAX_TRANSLATION_EPS 0.001
 #define MAX_ROTATION_EPS 0.9
 #define MAX_EPS 2
+// maximum number of voxels found by a radius search with at most the voxel resolution as radius,
+// the searches test no more than three positions along each axis
+#define MAX_NEAR_VOXELS 27
+// initial damping of the Levenberg-Marquardt solver relative to the hessian diagonal,
+// which starts with short steps like the default step size of the newton solver,
+// factor by which it changes after each trial step and maximum number of trial steps
+#define LM_INITIAL_DAMPING 10.0
+#define LM_DAMPING_FACTOR 10.0
+#define LM_MAX_TRIALS 10
+#ifndef EPHOS_NDT_DATA
+// name of the input and reference data files in the data directory
+#define EPHOS_NDT_DATA "ndt"
+#endif
+#ifndef EPHOS_SOLVER
+// optimization method unless the NDT_SOLVER environment variable selects another one
+#define EPHOS_SOLVER "NEWTON"
+#endif
+#ifndef EPHOS_RESOLUTION_LEVELS
+// number of voxel grids the alignment proceeds through, each twice as fine as the previous one
+#define EPHOS_RESOLUTION_LEVELS 1
+#endif
+
+/**
+ * Input data and results of testcases that are processed in one step.
+ */
+typedef struct {
+	// index of the first testcase
+	int first = 0;
+	// number of testcases
+	int count = 0;
+	pooled_array<PointCloudView> filtered_scan_ptr;
+	pooled_array<Matrix4f> init_guess;
+	pooled_array<CallbackResult> results;
+	pooled_array<PointCloudView> maps;
+} TestcaseBatch;
 
 class ndt_mapping : public kernel {
 private:
 	// the number of testcases read
 	int read_testcases = 0;
-	PointCloud* filtered_scan_ptr = nullptr;
-	Matrix4f* init_guess = nullptr;
-	CallbackResult* results = nullptr;
-	PointCloud* maps = nullptr;
+	// testcases processed in the current step
+	TestcaseBatch current_batch;
 	// testcase and result stream
-	std::ifstream input_file, output_file;
+	mapped_file input_file, output_file;
+	// maps of all testcases
+	// and the storage of the maps that are extended by following testcases
+	std::vector<PointCloudView> maps_;
+	std::vector<PointCloud> map_storage_;
 	// whether an abnormal deviation has been detected
 	bool error_so_far = false;
 	// maximum deviation from the reference data so far
@@ -56,22 +106,57 @@ private:
 	double transformation_epsilon_ = 0.1;
 	int max_iterations_ = 0;
 	// point clouds
-	PointCloud* input_ = nullptr;
-	PointCloud* target_ = nullptr;
+	const PointCloudView* input_ = nullptr;
+	const PointCloudView* target_ = nullptr;
 	// voxel grid spanning over all points
 	VoxelGrid target_cells_;
 	// voxel grid extend
 	PointXYZI minVoxel, maxVoxel;
 	int voxelDimension[3];
+	// incremental voxel map: extend of the map points,
+	// start of the map and number of its points added so far
+	PointXYZI map_min_, map_max_;
+	const PointXYZI* mapped_begin_ = nullptr;
+	size_t mapped_count_ = 0;
+	// transformed input point cloud
+	soa_cloud trans_columns_;
+	// voxel grid coordinates of the transformed input points
+	std::vector<int> trans_cells_[3];
+	// input point cloud in morton order
+	PointCloud sorted_input_;
+	PointCloudView sorted_input_view_;
+	// input point cloud reduced to one point per voxel,
+	// voxel codes of the input points and the start of each voxel in them
+	PointCloud filtered_scan_;
+	PointCloudView filtered_scan_view_;
+	std::vector<std::pair<uint64_t, int>> filter_order_;
+	std::vector<size_t> filter_starts_;
+	// voxel grid of the coarser resolution levels
+	VoxelGrid coarse_cells_;
+#if EPHOS_RESOLUTION_LEVELS > 1
+	// iterations and seconds spent on each resolution level, finest level first
+	long level_iterations_[EPHOS_RESOLUTION_LEVELS] = {};
+	double level_seconds_[EPHOS_RESOLUTION_LEVELS] = {};
+#endif
+#ifdef EPHOS_SOLVER_STATISTICS
+	// number of solver iterations and the time spent on them
+	long solver_iterations_ = 0;
+	double solver_seconds_ = 0.0;
+#endif
+#ifdef EPHOS_CAPTURE_SYSTEMS
+	// receives the linear systems of the solver steps
+	std::ofstream capture_file_;
+#endif
 public:
 	virtual void init();
 	virtual void run(int p = 1);
+	virtual void run_pipelined(int p = 1);
 	virtual bool check_output();
 protected:
 	/**
 	 * Reads the number of testcases in the data file
 	 */
-	int read_number_testcases(std::ifstream& input_file);
+	int read_number_testcases(mapped_file& input_file);
 	/**
 	 * Reads the next testcases.
 	 * count: number of datasets to read
@@ -79,30 +164,78 @@ protected:
 	 */
 	virtual int read_next_testcases(int count);
 	/**
-	 * Reads and compares algorithm results with the respective reference.
-	 * count: number of testcase results to compare
+	 * Reads and compares algorithm results with the respective reference of the current batch.
+	 */
+	virtual void check_next_outputs();
+	/**
+	 * Reads the next testcases into a batch, replacing its previous contents.
+	 * batch: batch to fill
+	 * count: number of datasets to read
+	 * return: number of data sets actually read.
+	 */
+	int read_batch(TestcaseBatch& batch, int count);
+	/**
+	 * Runs the algorithm on all datasets of a batch.
+	 */
+	void compute_batch(TestcaseBatch& batch);
+	/**
+	 * Compares the results of a batch with the reference data.
 	 */
-	virtual void check_next_outputs(int count);
+	void check_batch(TestcaseBatch& batch);
+	/**
+	 * Releases the memory held by a batch.
+	 */
+	void free_batch(TestcaseBatch& batch);
 	/**
 	 * Reduces a multi dimensional voxel grid index to one dimension.
 	 */
-	inline int linearizeAddr(const int x, const int y, const int z);
+	inline int64_t linearizeAddr(const int x, const int y, const int z);
 	/**
 	 * Reduces a coordinate to a voxel grid index.
 	 */
-	inline int linearizeCoord(const float x, const float y, const float z);
+	inline int64_t linearizeCoord(const float x, const float y, const float z);
+	/**
+	 * Restores the multi dimensional voxel grid index from a linearized one.
+	 */
+	inline void delinearizeAddr(int64_t addr, int& x, int& y, int& z);
+	/**
+	 * Reorders the occupied voxels of a grid by the morton code of their grid index,
+	 * so that neighbouring voxels are stored close to each other.
+	 */
+	void sortVoxels(VoxelGrid& grid);
+	/**
+	 * Looks up an occupied voxel by its linearized index.
+	 * return: position of the voxel in the cell array, -1 if the voxel is empty
+	 */
+	inline int findVoxel(const VoxelGrid& grid, int64_t key);
+	/**
+	 * Looks up a voxel by its linearized index and adds it to the grid if it is not present yet.
+	 * return: position of the voxel in the cell array
+	 */
+	int insertVoxel(VoxelGrid& grid, int64_t key);
+	/**
+	 * Finishes mean and inverse covariance of a voxel of the incremental map
+	 * if its points or the grid extend have changed since it was last finished.
+	 */
+	inline void refreshVoxel(VoxelGrid& grid, int idx);
 
 	double updateDerivatives (Vec6 &score_gradient,
 		Mat66 &hessian,
-		Vec3 &x_trans, Mat33 &c_inv,
+		Vec3 &x_trans, const Mat33 &c_inv,
 		bool compute_hessian = true);
 	void computePointDerivatives (Vec3 &x, bool compute_hessian = true);
 	void computeHessian (Mat66 &hessian,
-		PointCloudSource &trans_cloud, Vec6 &);
-	void updateHessian (Mat66 &hessian, Vec3 &x_trans, Mat33 &c_inv);
+		soa_cloud &trans_cloud, Vec6 &);
+	void updateHessian (Mat66 &hessian, Vec3 &x_trans, const Mat33 &c_inv);
+	// evaluation of the compact voxel gaussians
+	double updateDerivatives (Vec6 &score_gradient,
+		Mat66 &hessian,
+		Vec3 &x_trans, const VoxelCoefficient (&c_inv)[6],
+		bool compute_hessian = true);
+	void updateHessian (Mat66 &hessian, Vec3 &x_trans, const VoxelCoefficient (&c_inv)[6]);
 	double computeDerivatives (Vec6 &score_gradient,
 		Mat66 &hessian,
-		PointCloudSource &trans_cloud,
+		soa_cloud &trans_cloud,
 		Vec6 &p,
 		bool compute_hessian = true );
 	bool updateIntervalMT (double &a_l, double &f_l, double &g_l,
@@ -113,48 +246,104 @@ protected:
 		double a_t, double f_t, double g_t);
 	double computeStepLengthMT (const Vec6 &x, Vec6 &step_dir, double step_init, double step_max,
 				double step_min, double &score, Vec6 &score_gradient, Mat66 &hessian,
-				PointCloudSource &trans_cloud);
-	void computeTransformation(PointCloud &output, const Matrix4f &guess);
+				soa_cloud &trans_cloud);
+	void computeTransformation(soa_cloud &output, const Matrix4f &guess);
+	/**
+	 * Optimizes the transformation with Newton steps of a length
+	 * determined by a More-Thuente line search.
+	 * All solvers share this signature, init() chooses one of them as solver_.
+	 * trans_cloud: input point cloud transformed with the initial guess, receives the final one
+	 * p: transformation vector of the initial guess, receives the result
+	 * return: score of the resulting transformation
+	 */
+	double solveNewton (soa_cloud &trans_cloud, Vec6 &p);
+	/**
+	 * Optimizes the transformation with Levenberg-Marquardt steps.
+	 * The hessian is evaluated once per accepted step and reused with increasing damping
+	 * for the trial steps, which only evaluate score and gradient.
+	 */
+	double solveLevenbergMarquardt (soa_cloud &trans_cloud, Vec6 &p);
+	/**
+	 * Solves the linear system of a solver step for the step direction.
+	 * With EPHOS_CAPTURE_SYSTEMS the system is written to the capture file as well.
+	 */
+	void solveStep (Vec6 &delta_p, const Mat66 &hessian, const Vec6 &neg_grad);
+	// optimization method, chosen by name in init()
+	double (ndt_mapping::*solver_) (soa_cloud &trans_cloud, Vec6 &p) = &ndt_mapping::solveNewton;
+#ifdef EPHOS_SOLVER_STATISTICS
+	/**
+	 * Adds the duration of a solver iteration to the statistics.
+	 */
+	void recordIteration (std::chrono::high_resolution_clock::time_point start);
+#endif
+	/**
+	 * Applies a transformation to the input point cloud or a transformed copy of it.
+	 * With EPHOS_TRANSFORM_VOXEL_INDEX the voxel coordinates of the transformed points
+	 * are stored in trans_cells_ as well.
+	 * input and output may be the same cloud.
+	 */
+	void transformScan(const PointCloudView& input, soa_cloud& output, const Matrix4f& transform);
 	void computeAngleDerivatives (Vec6 &p, bool compute_hessian = true);
 	void ndt_align (const Matrix4f& guess);
+	/**
+	 * Aligns the input point cloud with the current voxel grid.
+	 * guess: initial transformation
+	 */
+	void alignLevel (const Matrix4f& guess);
 	/**
 	 * Performs point cloud specific voxel grid initialization.
 	 */
 	void initCompute();
+	/**
+	 * Adds the target point cloud to the incremental voxel map.
+	 * If the point cloud extends the previous one, only the additional points are inserted.
+	 * Otherwise the map is built anew.
+	 * A map extends the previous one if it starts at the same address and is not shorter,
+	 * so the caller may only append to a map while it keeps its storage.
+	 */
+	void updateMap();
 	void buildTransformationMatrix(Matrix4f &matrix, Vec6 transform);
 	/**
 	 * Computes the eulerangles from an rotation matrix.
 	 */
 	void eulerAngles(Matrix4f transform, Vec3 &result);
-	CallbackResult partial_points_callback(PointCloud &input_cloud, Matrix4f &init_guess, PointCloud& target_cloud);
+	/**
+	 * Reduces a point cloud to the centroids of the points inside each voxel
+	 * of a grid with the given leaf size and stores them in filtered_scan_.
+	 * return: view of the reduced point cloud
+	 */
+	const PointCloudView& filterScan(const PointCloudView& cloud, float leaf_size);
+	CallbackResult partial_points_callback(const PointCloudView &input_cloud, Matrix4f &init_guess, const PointCloudView& target_cloud);
 	/**
 	 * Helper function to select near voxels.
+	 * radius: search radius, at most the voxel resolution
+	 * indices: receives the positions of the near voxels in the cell array
+	 * return: number of near voxels
 	 */
 	int voxelRadiusSearch(
 		VoxelGrid &grid, const PointXYZI& point, double radius,
-		std::vector<Voxel> & indices,
-		std::vector<float> distances);
+		int (&indices)[MAX_NEAR_VOXELS]);
+	/**
+	 * Selects near voxels like voxelRadiusSearch()
+	 * but starts from the voxel coordinates computed during the transformation.
+	 * point_index: position of the transformed point in trans_cells_
+	 * radius: search radius, the voxel resolution
+	 */
+	int voxelNeighborSearch(
+		VoxelGrid &grid, const PointXYZI& point, size_t point_index, double radius,
+		int (&indices)[MAX_NEAR_VOXELS]);
 };
 
 
 /**
  * Reads the next point cloud.
+ * The resulting cloud refers to the mapped input file.
  */
-void  parseFilteredScan(std::ifstream& input_file, PointCloud* pointcloud) {
-	int32_t size;
+void  parseFilteredScan(mapped_file& input_file, PointCloudView* pointcloud) {
 	try {
-		input_file.read((char*)&(size), sizeof(int32_t));
-		pointcloud->clear();
-		for (int i = 0; i < size; i++)
-		{
-			PointXYZI p;
-			input_file.read((char*)&p.data[0], sizeof(float));
-			input_file.read((char*)&p.data[1], sizeof(float));
-			input_file.read((char*)&p.data[2], sizeof(float));
-			input_file.read((char*)&p.data[3], sizeof(float));
-			pointcloud->push_back(p);
-		}
-	}  catch (std::ifstream::failure) {
+		int32_t size = input_file.read<int32_t>();
+		*pointcloud = input_file.read_array<PointXYZI>(size);
+	}  catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading filtered scan");
 	}
 }
@@ -162,12 +351,10 @@ void  parseFilteredScan(std::ifstream& input_file, PointCloud* pointcloud) {
 /**
  * Reads the next initilization matrix.
  */
-void  parseInitGuess(std::ifstream& input_file, Matrix4f* initGuess) {
+void  parseInitGuess(mapped_file& input_file, Matrix4f* initGuess) {
 	try {
-	for (int h = 0; h < 4; h++)
-		for (int w = 0; w < 4; w++)
-			input_file.read((char*)&(initGuess->data[h][w]),sizeof(float));
-	}  catch (std::ifstream::failure) {
+		*initGuess = input_file.read<Matrix4f>();
+	}  catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading initial guess");
 	}
 }
@@ -175,65 +362,150 @@ void  parseInitGuess(std::ifstream& input_file, Matrix4f* initGuess) {
 /**
  * Reads the next reference matrix.
  */
-void parseResult(std::ifstream& output_file, CallbackResult* goldenResult) {
+void parseResult(mapped_file& output_file, CallbackResult* goldenResult) {
 	try {
-		for (int h = 0; h < 4; h++)
-			for (int w = 0; w < 4; w++)
+		goldenResult->final_transformation = output_file.read<Matrix4f>();
+		goldenResult->fitness_score = output_file.read<double>();
+		goldenResult->converged = output_file.read<bool>();
+	}  catch (const std::ios_base::failure&) {
+		throw std::ios_base::failure("Error reading reference result");
+	}
+}
+
+/**
+ * Records the start of every testcase in the input and reference data files and reads the maps.
+ * A negative map size stands for the map of the previous testcase, extended by that many points.
+ * Extended maps are gathered in map_storage, where they share the storage with the map they extend.
+ */
+void indexTestcases(mapped_file& input_file, mapped_file& output_file, int testcases,
+	std::vector<PointCloudView>& maps, std::vector<PointCloud>& map_storage) {
+	maps.assign(testcases, PointCloudView());
+	map_storage.clear();
+	// position of the map of every testcase in map_storage
+	std::vector<int> storage(testcases, -1);
+	for (int i = 0; i < testcases; i++)
+	{
+		try {
+			input_file.add_testcase();
+			input_file.skip(sizeof(Matrix4f));
+			// filtered scan
+			int32_t size = input_file.read<int32_t>();
+			input_file.skip(size*sizeof(PointXYZI));
+			// map
+			size = input_file.read<int32_t>();
+			if (size >= 0)
 			{
-				output_file.read((char*)&(goldenResult->final_transformation.data[h][w]), sizeof(float));
+				maps[i] = input_file.read_array<PointXYZI>(size);
 			}
-		output_file.read((char*)&(goldenResult->fitness_score), sizeof(double));
-		output_file.read((char*)&(goldenResult->converged), sizeof(bool));
-	}  catch (std::ifstream::failure) {
-		throw std::ios_base::failure("Error reading reference result");		
+			else
+			{
+				if (i == 0)
+					throw std::ios_base::failure("Extended map without a previous map");
+				if (storage[i - 1] < 0)
+				{
+					storage[i - 1] = map_storage.size();
+					map_storage.emplace_back(maps[i - 1].begin(), maps[i - 1].end());
+				}
+				storage[i] = storage[i - 1];
+				PointCloudView added = input_file.read_array<PointXYZI>(-size);
+				PointCloud& map = map_storage[storage[i]];
+				map.insert(map.end(), added.begin(), added.end());
+				maps[i].count = map.size();
+			}
+		} catch (const std::ios_base::failure&) {
+			throw std::ios_base::failure("Error indexing the testcase file");
+		}
+		try {
+			output_file.add_testcase();
+			output_file.skip(sizeof(Matrix4f) + sizeof(double) + sizeof(bool));
+		} catch (const std::ios_base::failure&) {
+			throw std::ios_base::failure("Error indexing the results file");
+		}
 	}
+	// the storage does not move any more
+	for (int i = 0; i < testcases; i++)
+		if (storage[i] >= 0)
+			maps[i].elements = map_storage[storage[i]].data();
 }
 
-int ndt_mapping::read_next_testcases(int count)
+void ndt_mapping::free_batch(TestcaseBatch& batch)
+{
+	batch.maps.release();
+	batch.filtered_scan_ptr.release();
+	batch.init_guess.release();
+	batch.results.release();
+	batch.count = 0;
+}
+
+int ndt_mapping::read_batch(TestcaseBatch& batch, int count)
 {
 	int i;
-	// free memory used in the previous test case and allocate new one
-	delete [] maps;
-	maps = new PointCloud[count];
-	delete [] filtered_scan_ptr;
-	filtered_scan_ptr = new PointCloud[count];
-	delete [] init_guess;
-	init_guess = new Matrix4f[count];
-	delete [] results;
-	results = new CallbackResult[count];
+	// reuse the memory of the previous test case
+	// and only allocate new if more testcases are read at once
+	batch.maps.acquire(count);
+	batch.filtered_scan_ptr.acquire(count);
+	batch.init_guess.acquire(count);
+	batch.results.acquire(count);
+	batch.first = read_testcases;
 	// parse the test cases
 	for (i = 0; (i < count) && (read_testcases < testcases); i++,read_testcases++)
 	{
 		try {
-			parseInitGuess(input_file, init_guess + i);
-			parseFilteredScan(input_file, filtered_scan_ptr + i);
-			parseFilteredScan(input_file, maps + i);
-		} catch (std::ios_base::failure& e) {
+			input_file.seek_testcase(read_testcases);
+			parseInitGuess(input_file, &batch.init_guess[i]);
+			parseFilteredScan(input_file, &batch.filtered_scan_ptr[i]);
+			batch.maps[i] = maps_[read_testcases];
+		} catch (const std::ios_base::failure& e) {
 			std::cerr << e.what() << std::endl;
 			exit(-3);
 		}
 	}
+	batch.count = i;
 	return i;
 }
 
+int ndt_mapping::read_next_testcases(int count)
+{
+	return read_batch(current_batch, count);
+}
+
 
-int ndt_mapping::read_number_testcases(std::ifstream& input_file)
+int ndt_mapping::read_number_testcases(mapped_file& input_file)
 {
 	int32_t number;
 	try {
-		input_file.read((char*)&(number), sizeof(int32_t));
-	} catch (std::ifstream::failure) {
+		number = input_file.read<int32_t>();
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading number of test cases");
 	}
 	return number;
 }
 
-inline int ndt_mapping::linearizeAddr(const int x, const int y, const int z)
+inline int64_t ndt_mapping::linearizeAddr(const int x, const int y, const int z)
+{
+#ifdef EPHOS_INCREMENTAL_MAP
+	// the grid dimensions change while the map grows, so the indices are packed instead
+	return ((int64_t)z << 42) | ((int64_t)y << 21) | x;
+#else
+	return  (x + voxelDimension[0] * (y + voxelDimension[1] * (int64_t)z));
+#endif
+}
+
+inline void ndt_mapping::delinearizeAddr(int64_t addr, int& x, int& y, int& z)
 {
-	return  (x + voxelDimension[0] * (y + voxelDimension[1] * z));
+#ifdef EPHOS_INCREMENTAL_MAP
+	x = addr & 0x1FFFFF;
+	y = (addr >> 21) & 0x1FFFFF;
+	z = addr >> 42;
+#else
+	x = addr % voxelDimension[0];
+	addr /= voxelDimension[0];
+	y = addr % voxelDimension[1];
+	z = addr / voxelDimension[1];
+#endif
 }
 
-inline int ndt_mapping::linearizeCoord(const float x, const float y, const float z)
+inline int64_t ndt_mapping::linearizeCoord(const float x, const float y, const float z)
 {
 	// determine cell index
 	int idx_x = (x - minVoxel.data[0]) / resolution_;
@@ -243,19 +515,185 @@ inline int ndt_mapping::linearizeCoord(const float x, const float y, const float
 	return linearizeAddr(idx_x, idx_y, idx_z);
 }
 
+/**
+ * Computes the hash table slot at which the search for a voxel starts.
+ */
+inline size_t voxelHash(const VoxelGrid& grid, int64_t key)
+{
+	// fibonacci hashing
+	return (((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32) & (grid.slots.size() - 1);
+}
+
+inline int ndt_mapping::findVoxel(const VoxelGrid& grid, int64_t key)
+{
+	size_t mask = grid.slots.size() - 1;
+	for (size_t slot = voxelHash(grid, key); ; slot = (slot + 1) & mask)
+	{
+		if (grid.slots[slot].key == key)
+			return grid.slots[slot].cell;
+		if (grid.slots[slot].key < 0)
+			return -1;
+	}
+}
+
+/**
+ * Spreads the lower 21 bits of a value, so that each bit is followed by two zero bits.
+ */
+inline uint64_t spreadBits(uint64_t v)
+{
+	v &= 0x1FFFFF;
+	v = (v | v << 32) & 0x1F00000000FFFFull;
+	v = (v | v << 16) & 0x1F0000FF0000FFull;
+	v = (v | v << 8) & 0x100F00F00F00F00Full;
+	v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+/**
+ * Interleaves the bits of a three dimensional index to its position on the Z-order curve.
+ */
+inline uint64_t mortonCode(int x, int y, int z)
+{
+	return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+/**
+ * Copies a point cloud in the morton order of the cells of a grid with the given resolution.
+ * Points that are close to each other are then processed one after another.
+ */
+void sortMorton(const PointCloudView& cloud, float resolution, PointCloud& sorted)
+{
+	sorted.resize(cloud.size());
+	if (cloud.empty())
+		return;
+	PointXYZI minPoint = cloud[0];
+	for (const PointXYZI& point : cloud)
+		for (int elem = 0; elem < 3; elem++)
+			if (point.data[elem] < minPoint.data[elem])
+				minPoint.data[elem] = point.data[elem];
+	std::vector<std::pair<uint64_t, int>> order(cloud.size());
+	for (size_t i = 0; i < cloud.size(); i++)
+	{
+		int x = (cloud[i].data[0] - minPoint.data[0]) / resolution;
+		int y = (cloud[i].data[1] - minPoint.data[1]) / resolution;
+		int z = (cloud[i].data[2] - minPoint.data[2]) / resolution;
+		order[i] = std::make_pair(mortonCode(x, y, z), (int)i);
+	}
+	std::sort(order.begin(), order.end());
+	for (size_t i = 0; i < cloud.size(); i++)
+		sorted[i] = cloud[order[i].second];
+}
+
+/**
+ * Moves the voxels of a grid to a hash table of the given size.
+ */
+void rehashVoxels(VoxelGrid& grid, size_t slotNo)
+{
+	VoxelSlot emptySlot = { -1, 0 };
+	std::vector<VoxelSlot> slots(slotNo, emptySlot);
+	slots.swap(grid.slots);
+	size_t mask = slotNo - 1;
+	for (const VoxelSlot& entry : slots)
+	{
+		if (entry.key < 0)
+			continue;
+		size_t slot = voxelHash(grid, entry.key);
+		while (grid.slots[slot].key >= 0)
+			slot = (slot + 1) & mask;
+		grid.slots[slot] = entry;
+	}
+}
+
+void ndt_mapping::sortVoxels(VoxelGrid& grid)
+{
+	// determine the morton codes from the keys in the hash table
+	std::vector<std::pair<uint64_t, int>> order;
+	order.reserve(grid.cells.size());
+	for (const VoxelSlot& slot : grid.slots)
+	{
+		if (slot.key < 0)
+			continue;
+		int x, y, z;
+		delinearizeAddr(slot.key, x, y, z);
+		order.push_back(std::make_pair(mortonCode(x, y, z), slot.cell));
+	}
+	std::sort(order.begin(), order.end());
+	// move the cells and remember their new positions
+	std::vector<int> position(grid.cells.size());
+	std::vector<Voxel> cells(grid.cells.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		cells[i] = grid.cells[order[i].second];
+		position[order[i].second] = i;
+	}
+	grid.cells.swap(cells);
+#ifdef EPHOS_INCREMENTAL_MAP
+	std::vector<VoxelSums> sums(grid.sums.size());
+	for (size_t i = 0; i < order.size(); i++)
+		sums[i] = grid.sums[order[i].second];
+	grid.sums.swap(sums);
+#endif
+	for (VoxelSlot& slot : grid.slots)
+		if (slot.key >= 0)
+			slot.cell = position[slot.cell];
+}
+
+int ndt_mapping::insertVoxel(VoxelGrid& grid, int64_t key)
+{
+	// keep the hash table at most half full
+	if (2 * (grid.cells.size() + 1) > grid.slots.size())
+		rehashVoxels(grid, 2 * grid.slots.size());
+	size_t mask = grid.slots.size() - 1;
+	size_t slot = voxelHash(grid, key);
+	while (grid.slots[slot].key >= 0)
+	{
+		if (grid.slots[slot].key == key)
+			return grid.slots[slot].cell;
+		slot = (slot + 1) & mask;
+	}
+	// create an empty voxel
+	Voxel cell;
+	cell.numberPoints = 0;
+	cell.mean[0] = 0;
+	cell.mean[1] = 0;
+	cell.mean[2] = 0;
+	memset(cell.invCovariance.data, 0, sizeof(double) * 3 * 3);
+	cell.invCovariance.data[2][0] = 1.0;
+	cell.invCovariance.data[1][1] = 1.0;
+	cell.invCovariance.data[0][2] = 1.0;
+	grid.slots[slot].key = key;
+	grid.slots[slot].cell = grid.cells.size();
+	grid.cells.push_back(cell);
+#ifdef EPHOS_INCREMENTAL_MAP
+	VoxelSums sums;
+	sums.numberPoints = 0;
+	memcpy(sums.pointSum, cell.mean, sizeof(Vec3));
+	sums.productSum = cell.invCovariance;
+	sums.generation = -1;
+	grid.sums.push_back(sums);
+#endif
+	return grid.slots[slot].cell;
+}
+
 int ndt_mapping::voxelRadiusSearch(VoxelGrid &grid, const PointXYZI& point, double radius,
-	std::vector<Voxel> & indices,
-	std::vector<float> distances)
+	int (&indices)[MAX_NEAR_VOXELS])
 {
 	int result = 0;
-	indices.clear();
-	distances.clear();
 	// make sure to search through all potentially near voxels
+	// positions are resolution_ apart, so a radius up to resolution_ yields three positions per axis
+	// and at most MAX_NEAR_VOXELS results
+	// the position counters keep a larger radius from overrunning the indices
 	float radiusFinal = radius + 0.001f;
 	// test all voxels in the vicinity
-	for (float z = point.data[2] - radius; z <= point.data[2] + radiusFinal; z+= resolution_)
-		for (float y = point.data[1] - radius; y <= point.data[1] + radiusFinal; y+= resolution_)
-			for (float x = point.data[0] - radius; x <= point.data[0] + radiusFinal; x+= resolution_)
+	float z = point.data[2] - radius;
+	for (int iz = 0; iz < 3 && z <= point.data[2] + radiusFinal; iz++, z += resolution_)
+	{
+		float y = point.data[1] - radius;
+		for (int iy = 0; iy < 3 && y <= point.data[1] + radiusFinal; iy++, y += resolution_)
+		{
+			float x = point.data[0] - radius;
+			for (int ix = 0; ix < 3 && x <= point.data[0] + radiusFinal; ix++, x += resolution_)
 			{
 				// avoid accesses out of bounds
 				if ((x < minVoxel.data[0]) ||
@@ -267,9 +705,15 @@ int ndt_mapping::voxelRadiusSearch(VoxelGrid &grid, const PointXYZI& point, doub
 				{
 					continue;
 				}
+				// empty voxels have no mean to compare with
+				int idx = findVoxel(grid, linearizeCoord(x, y, z));
+				if (idx < 0)
+					continue;
+#ifdef EPHOS_INCREMENTAL_MAP
+				refreshVoxel(grid, idx);
+#endif
 				// determine the distance to the voxel mean
-				int idx =  linearizeCoord(x, y, z);
-				Vec3 &c =  grid[idx].mean;
+				const Vec3 &c =  grid.cells[idx].mean;
 				float dx = c[0] - point.data[0];
 				float dy = c[1] - point.data[1];
 				float dz = c[2] - point.data[2];
@@ -277,130 +721,307 @@ int ndt_mapping::voxelRadiusSearch(VoxelGrid &grid, const PointXYZI& point, doub
 				// add near cells to the results
 				if (dist < radius)
 				{
+					indices[result] = idx;
 					result++;
-					indices.push_back(grid[idx]);
-					distances.push_back(dist);
 				}
 			}
+		}
+	}
 	return result;
 }
 
-/**
- * Solves Ax = b for x.
- * Maybe not as good when handling very ill conditioned systems, but is faster for a 6x6 matrix 
- * and works well enough in practice.
- */
-void solve(Vec6& result, Mat66 A, Vec6& b)
+int ndt_mapping::voxelNeighborSearch(VoxelGrid &grid, const PointXYZI& point, size_t point_index, double radius,
+	int (&indices)[MAX_NEAR_VOXELS])
 {
-	double pivot;
-
-	// bring to upper diagonal
-	for(int j = 0; j < 6; j++)
+	int result = 0;
+	const int64_t cell[3] = { trans_cells_[0][point_index], trans_cells_[1][point_index], trans_cells_[2][point_index] };
+	// test the same positions as the radius search,
+	// which lie in the voxel of the point and the ones next to it
+	for (int dz = -1; dz <= 1; dz++)
 	{
-		// search for the biggest entry
-		double max = std::fabs(A.data[j][j]);
-		int mi = j;
-		for (int i = j + 1; i < 6; i++)
-			if (std::fabs(A.data[i][j]) > max)
-			{
-				mi = i;
-				max = std::fabs(A.data[i][j]);
-			}
-		// swap lines mi and j
-		if (mi != j)
-			for (int i = 0; i < 6; i++)
-			{
-				double temp = A.data[mi][i];
-				A.data[mi][i] = A.data[j][i];
-				A.data[j][i] = temp;
-			}
-		if (max == 0.0) {
-			// we have a singular matrix
-			A.data[j][j] = MAX_TRANSLATION_EPS;
-		}
-		// subtract lines to yield a triagonal matrix
-		for (int i = j+1; i < 6; i++)
+		float z = point.data[2] + dz*radius;
+		// avoid accesses out of bounds
+		if ((z < minVoxel.data[2]) || (z > maxVoxel.data[2]) ||
+			(cell[2] + dz < 0) || (cell[2] + dz >= voxelDimension[2]))
+			continue;
+		for (int dy = -1; dy <= 1; dy++)
 		{
-			pivot=A.data[i][j]/A.data[j][j];
-			for(int k = 0; k < 6; k++)
+			float y = point.data[1] + dy*radius;
+			if ((y < minVoxel.data[1]) || (y > maxVoxel.data[1]) ||
+				(cell[1] + dy < 0) || (cell[1] + dy >= voxelDimension[1]))
+				continue;
+			for (int dx = -1; dx <= 1; dx++)
 			{
-				A.data[i][k]=A.data[i][k]-pivot*A.data[j][k];
+				float x = point.data[0] + dx*radius;
+				if ((x < minVoxel.data[0]) || (x > maxVoxel.data[0]) ||
+					(cell[0] + dx < 0) || (cell[0] + dx >= voxelDimension[0]))
+					continue;
+				// empty voxels have no mean to compare with
+				int idx = findVoxel(grid, linearizeAddr(cell[0] + dx, cell[1] + dy, cell[2] + dz));
+				if (idx < 0)
+					continue;
+#ifdef EPHOS_INCREMENTAL_MAP
+				refreshVoxel(grid, idx);
+#endif
+				// determine the distance to the voxel mean
+				const Vec3 &c =  grid.cells[idx].mean;
+				float distX = c[0] - point.data[0];
+				float distY = c[1] - point.data[1];
+				float distZ = c[2] - point.data[2];
+				float dist = sqrt(distX * distX + distY * distY + distZ * distZ);
+				// add near cells to the results
+				if (dist < radius)
+				{
+					indices[result] = idx;
+					result++;
+				}
 			}
-			b[i]=b[i]-pivot*b[j];
 		}
 	}
-	// backward substituion
-	result[5]=b[5]/A.data[5][5];
-	for( int i = 4; i >= 0; i--)
-	{
-		double sum=0.0;
-		for(int j = i+1; j < 6; j++)
-		{
-			sum=sum+A.data[i][j]*result[j];
-		}
-		result[i]=(b[i]-sum)/A.data[i][i];
-	}
+	return result;
 }
 
 void ndt_mapping::init() {
 	std::cout << "init\n";
-	// open data file streams
-	input_file.exceptions ( std::ifstream::failbit | std::ifstream::badbit );
-	output_file.exceptions ( std::ifstream::failbit | std::ifstream::badbit );
+	// map the data files
 	try {
-		input_file.open("../../../data/ndt_input.dat", std::ios::binary);
-	} catch (std::ifstream::failure) {
+		input_file.open("../../../data/" EPHOS_NDT_DATA "_input.dat");
+	} catch (const std::ios_base::failure&) {
 		std::cerr << "Error opening the testcase file" << std::endl;
 		exit(-3);
 	}
 	try {
-		output_file.open("../../../data/ndt_output.dat", std::ios::binary);
-	}  catch (std::ifstream::failure e) {
+		output_file.open("../../../data/" EPHOS_NDT_DATA "_output.dat");
+	}  catch (const std::ios_base::failure&) {
 		std::cerr << "Error opening the results file" << std::endl;
 		exit(-3);
 	}
 	// consume the number of testcases from the testcase file
+	// and find the start of every testcase
 	try {
 		testcases = read_number_testcases(input_file);
-	} catch (std::ios_base::failure& e) {
+		indexTestcases(input_file, output_file, testcases, maps_, map_storage_);
+	} catch (const std::ios_base::failure& e) {
 		std::cerr << e.what() << std::endl;
 		exit(-3);
 	}
+	// the build option selects the optimization method unless it is overridden at runtime
+	const char* solver = getenv("NDT_SOLVER");
+	if (solver == nullptr || *solver == '\0')
+		solver = EPHOS_SOLVER;
+	if (strcmp(solver, "NEWTON") == 0)
+		solver_ = &ndt_mapping::solveNewton;
+	else if (strcmp(solver, "LEVENBERG_MARQUARDT") == 0)
+		solver_ = &ndt_mapping::solveLevenbergMarquardt;
+	else
+	{
+		std::cerr << "Unknown solver " << solver << std::endl;
+		exit(-3);
+	}
+#ifdef EPHOS_CAPTURE_SYSTEMS
+	capture_file_.open(EPHOS_CAPTURE_SYSTEMS, std::ios::binary);
+	if (!capture_file_)
+	{
+		std::cerr << "Error opening the capture file " EPHOS_CAPTURE_SYSTEMS << std::endl;
+		exit(-3);
+	}
+#endif
 	// prepare the first iteration
 	error_so_far = false;
 	max_delta = 0.0;
-	maps = nullptr;
-	init_guess = nullptr;
-	filtered_scan_ptr = nullptr;
-	results = nullptr;
+	free_batch(current_batch);
 	std::cout << "done\n" << std::endl;
 }
 
 /**
- * Applies the transformation matrix to all point cloud elements
- * input: points to be transformed
- * output: transformed points
+ * Voxel grid coordinates of transformed points, computed along with the transformation on request.
+ */
+typedef struct VoxelCoordinates {
+	// lower grid corner
+	float min[3];
+	// voxel edge length
+	float resolution;
+	// receive the x, y and z coordinates of the points,
+	// rounded down so that points just below the grid corner get negative coordinates
+	int* cell[3];
+} VoxelCoordinates;
+
+/**
+ * Applies the transformation matrix to the points from begin to end.
+ * With EPHOS_TRANSFORM_DOUBLE the coordinates are accumulated in double precision
+ * with fused multiply-add operations.
+ * input: points to be transformed, read in place
+ * output: coordinates of the transformed points
  * transform: transformation matrix
+ * voxels: receives the voxel coordinates of the transformed points, if not null
  */
-void transformPointCloud(const PointCloud& input, PointCloud &output, Matrix4f transform)
+void transformPoints(const PointXYZI* input, soa_cloud& output, const Matrix4f& transform,
+	size_t begin, size_t end, const VoxelCoordinates* voxels)
 {
-	if (&input != &output)
+	float* out[3] = { output.x(), output.y(), output.z() };
+	for (size_t i = begin; i < end; i++)
 	{
-		output.clear();
-		output.resize(input.size());
+		const float* point = input[i].data;
+		float transformed[3];
+		for (int row = 0; row < 3; row++)
+		{
+#ifdef EPHOS_TRANSFORM_DOUBLE
+			transformed[row] = std::fma((double)transform.data[row][0], point[0],
+				std::fma((double)transform.data[row][1], point[1],
+				std::fma((double)transform.data[row][2], point[2], (double)transform.data[row][3])));
+#else
+			transformed[row] = transform.data[row][0] * point[0]
+			+ transform.data[row][1] * point[1]
+			+ transform.data[row][2] * point[2]
+			+ transform.data[row][3];
+#endif
+		}
+		for (int row = 0; row < 3; row++)
+			out[row][i] = transformed[row];
+		if (voxels)
+			for (int row = 0; row < 3; row++)
+				voxels->cell[row][i] = std::floor((transformed[row] - voxels->min[row]) / voxels->resolution);
 	}
-	for (auto it = 0 ; it < input.size(); ++it)
+}
+
+#if defined(EPHOS_X86_SIMD)
+/**
+ * Vectorized variant of transformPoints() that processes eight points per iteration.
+ * The float variant performs the same operations in the same order and yields identical results.
+ * Only the double variant enables FMA instructions, the compiler could otherwise contract
+ * the multiplications and additions of the float variant.
+ */
+#ifdef EPHOS_TRANSFORM_DOUBLE
+__attribute__((target("avx2,fma")))
+#else
+__attribute__((target("avx2")))
+#endif
+void transformPointsAVX2(const PointXYZI* input, soa_cloud& output, const Matrix4f& transform,
+	size_t begin, size_t end, const VoxelCoordinates* voxels)
+{
+	float* out[3] = { output.x(), output.y(), output.z() };
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8)
 	{
-		PointXYZI transformed;
+		// transpose eight point records into coordinate vectors,
+		// the lower lanes hold the first four points and the upper lanes the last four
+		__m256 record[4];
+		for (int k = 0; k < 4; k++)
+			record[k] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(input[i + k].data)),
+				_mm_loadu_ps(input[i + k + 4].data), 1);
+		__m256 xy_low = _mm256_unpacklo_ps(record[0], record[1]);
+		__m256 xy_high = _mm256_unpacklo_ps(record[2], record[3]);
+		__m256 zw_low = _mm256_unpackhi_ps(record[0], record[1]);
+		__m256 zw_high = _mm256_unpackhi_ps(record[2], record[3]);
+		__m256 point[3];
+		point[0] = _mm256_shuffle_ps(xy_low, xy_high, _MM_SHUFFLE(1, 0, 1, 0));
+		point[1] = _mm256_shuffle_ps(xy_low, xy_high, _MM_SHUFFLE(3, 2, 3, 2));
+		point[2] = _mm256_shuffle_ps(zw_low, zw_high, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 transformed[3];
 		for (int row = 0; row < 3; row++)
 		{
-			transformed.data[row] = transform.data[row][0] * input[it].data[0]
-			+ transform.data[row][1] * input[it].data[1]
-			+ transform.data[row][2] * input[it].data[2]
-			+ transform.data[row][3];
+#ifdef EPHOS_TRANSFORM_DOUBLE
+			// lower and upper four points
+			__m256d low = _mm256_set1_pd(transform.data[row][3]);
+			__m256d high = low;
+			for (int col = 2; col >= 0; col--)
+			{
+				__m256d factor = _mm256_set1_pd(transform.data[row][col]);
+				low = _mm256_fmadd_pd(factor, _mm256_cvtps_pd(_mm256_castps256_ps128(point[col])), low);
+				high = _mm256_fmadd_pd(factor, _mm256_cvtps_pd(_mm256_extractf128_ps(point[col], 1)), high);
+			}
+			transformed[row] = _mm256_insertf128_ps(
+				_mm256_castps128_ps256(_mm256_cvtpd_ps(low)), _mm256_cvtpd_ps(high), 1);
+#else
+			transformed[row] = _mm256_mul_ps(_mm256_set1_ps(transform.data[row][0]), point[0]);
+			transformed[row] = _mm256_add_ps(transformed[row],
+				_mm256_mul_ps(_mm256_set1_ps(transform.data[row][1]), point[1]));
+			transformed[row] = _mm256_add_ps(transformed[row],
+				_mm256_mul_ps(_mm256_set1_ps(transform.data[row][2]), point[2]));
+			transformed[row] = _mm256_add_ps(transformed[row], _mm256_set1_ps(transform.data[row][3]));
+#endif
+		}
+		for (int row = 0; row < 3; row++)
+			_mm256_storeu_ps(out[row] + i, transformed[row]);
+		if (voxels)
+		{
+			__m256 resolution = _mm256_set1_ps(voxels->resolution);
+			for (int row = 0; row < 3; row++)
+			{
+				__m256 offset = _mm256_sub_ps(transformed[row], _mm256_set1_ps(voxels->min[row]));
+				_mm256_storeu_si256((__m256i*)(voxels->cell[row] + i),
+					_mm256_cvttps_epi32(_mm256_floor_ps(_mm256_div_ps(offset, resolution))));
+			}
 		}
-		output[it] = transformed;
 	}
+	// remaining points
+	transformPoints(input, output, transform, i, end, voxels);
+}
+#endif
+
+/**
+ * Signature of the point transformation functions.
+ */
+typedef void (*TransformFunction)(
+	const PointXYZI*, soa_cloud&, const Matrix4f&,
+	size_t, size_t, const VoxelCoordinates*);
+
+/**
+ * Selects the fastest point transformation function supported by the processor.
+ */
+TransformFunction selectTransform()
+{
+#if defined(EPHOS_X86_SIMD)
+#ifdef EPHOS_TRANSFORM_DOUBLE
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+#else
+	if (__builtin_cpu_supports("avx2"))
+#endif
+		return transformPointsAVX2;
+#endif
+	return transformPoints;
+}
+
+/**
+ * Applies the transformation matrix to all point cloud elements
+ * input: points to be transformed
+ * output: coordinates of the transformed points
+ * transform: transformation matrix
+ * voxels: receives the voxel coordinates of the transformed points, if not null
+ */
+void transformPointCloud(const PointCloudView& input, soa_cloud& output, const Matrix4f& transform,
+	const VoxelCoordinates* voxels = nullptr)
+{
+	output.resize(input.size());
+	static const TransformFunction transformation = selectTransform();
+	transformation(input.begin(), output, transform, 0, input.size(), voxels);
+}
+
+/**
+ * Reads a transformed point from a point cloud that is stored in columns.
+ * The fourth component is 1 as for homogeneous coordinates.
+ */
+inline PointXYZI pointAt(const soa_cloud& cloud, size_t i)
+{
+	PointXYZI point = {{ cloud.x()[i], cloud.y()[i], cloud.z()[i], 1.0f }};
+	return point;
+}
+
+void ndt_mapping::transformScan(const PointCloudView& input, soa_cloud& output, const Matrix4f& transform)
+{
+#ifdef EPHOS_TRANSFORM_VOXEL_INDEX
+	VoxelCoordinates voxels;
+	for (int i = 0; i < 3; i++)
+	{
+		voxels.min[i] = minVoxel.data[i];
+		trans_cells_[i].resize(input.size());
+		voxels.cell[i] = trans_cells_[i].data();
+	}
+	voxels.resolution = resolution_;
+	transformPointCloud(input, output, transform, &voxels);
+#else
+	transformPointCloud(input, output, transform);
+#endif
 }
 
 /**
@@ -437,7 +1058,7 @@ inline double auxilaryFunction_PsiMT (double a, double f_a, double f_0, double g
 
 double ndt_mapping::updateDerivatives (Vec6 &score_gradient,
 	Mat66 &hessian,
-	Vec3 &x_trans, Mat33 &c_inv,
+	Vec3 &x_trans, const Mat33 &c_inv,
 	bool compute_hessian)
 {
 	// matrix preparation
@@ -560,26 +1181,31 @@ void ndt_mapping::computePointDerivatives (Vec3 &x, bool compute_hessian)
 }
 
 void ndt_mapping::computeHessian(
-	Mat66 &hessian, PointCloud &trans_cloud, Vec6 &)
+	Mat66 &hessian, soa_cloud &trans_cloud, Vec6 &)
 {
 	// temporary data structures
 	PointXYZI  x_pt, x_trans_pt; // Original Point and Transformed Point
 	Vec3 x, x_trans; // Original Point and Transformed Point
-	Voxel cell; // Occupied Voxel
-	Mat33 c_inv; // Inverse Covariance of Occupied Voxel
+	int neighborhood[MAX_NEAR_VOXELS]; // Occupied Voxels
 	memset(&(hessian.data[0][0]), 0, sizeof(double) * 6 * 6);
 	// Update hessian for each point, line 17 in Algorithm 2 [Magnusson 2009]
 	for (size_t idx = 0; idx < input_->size (); idx++)
 	{
-		x_trans_pt = trans_cloud[idx];
+		x_trans_pt = pointAt(trans_cloud, idx);
 		// Find neighbors
-		std::vector<Voxel> neighborhood;
-		std::vector<float> distances;
-		voxelRadiusSearch (target_cells_, x_trans_pt, resolution_, neighborhood, distances);
+#ifdef EPHOS_TRANSFORM_VOXEL_INDEX
+		int neighbors = voxelNeighborSearch (target_cells_, x_trans_pt, idx, resolution_, neighborhood);
+#else
+		int neighbors = voxelRadiusSearch (target_cells_, x_trans_pt, resolution_, neighborhood);
+#endif
 		// execute for each neighbor
-		for (auto neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
+		for (int n = 0; n < neighbors; n++)
 		{
-			cell = *neighborhood_it;
+#ifdef EPHOS_VOXEL_COEFFICIENTS
+			const VoxelGaussian& cell = target_cells_.gaussians[neighborhood[n]];
+#else
+			const Voxel& cell = target_cells_.cells[neighborhood[n]];
+#endif
 			// extract point
 			x_pt = (*input_)[idx];
 			x[0] = x_pt.data[0];
@@ -592,16 +1218,15 @@ void ndt_mapping::computeHessian(
 			x_trans[0] -= cell.mean[0];
 			x_trans[1] -= cell.mean[1];
 			x_trans[2] -= cell.mean[2];
-			c_inv = cell.invCovariance;
 			// Compute derivative of transform function w.r.t. transform vector, J_E and H_E in Equations 6.18 and 6.20 [Magnusson 2009]
 			computePointDerivatives (x);
 			// Update hessian, lines 21 in Algorithm 2, according to Equations 6.10, 6.12 and 6.13, respectively [Magnusson 2009]
-			updateHessian (hessian, x_trans, c_inv);
+			updateHessian (hessian, x_trans, cell.invCovariance);
 		}
 	}
 }
 
-void ndt_mapping::updateHessian (Mat66 &hessian, Vec3 &x_trans, Mat33 &c_inv)
+void ndt_mapping::updateHessian (Mat66 &hessian, Vec3 &x_trans, const Mat33 &c_inv)
 {
 	Vec3 cov_dxd_pi;
 	// Equation 6.9 [Magnusson 2009]
@@ -648,9 +1273,102 @@ void ndt_mapping::updateHessian (Mat66 &hessian, Vec3 &x_trans, Mat33 &c_inv)
 	}
 }
 
+/**
+ * Multiplies the symmetric inverse covariance of a compact voxel with a vector.
+ */
+inline void covarianceProduct(const VoxelCoefficient (&c_inv)[6], double x, double y, double z, Vec3 &result)
+{
+	result[0] = c_inv[0] * x + c_inv[3] * y + c_inv[4] * z;
+	result[1] = c_inv[3] * x + c_inv[1] * y + c_inv[5] * z;
+	result[2] = c_inv[4] * x + c_inv[5] * y + c_inv[2] * z;
+}
+
+/**
+ * Quadratic form of the inverse covariance of a compact voxel, Equation 6.9 [Magnusson 2009].
+ * The mixed terms appear twice in the full matrix.
+ */
+inline double covarianceForm(const VoxelCoefficient (&c_inv)[6], const Vec3 &x)
+{
+	return c_inv[0] * x[0] * x[0] +
+		c_inv[1] * x[1] * x[1] +
+		c_inv[2] * x[2] * x[2] +
+		2 * c_inv[3] * x[0] * x[1] +
+		2 * c_inv[4] * x[0] * x[2] +
+		2 * c_inv[5] * x[1] * x[2];
+}
+
+double ndt_mapping::updateDerivatives (Vec6 &score_gradient,
+	Mat66 &hessian,
+	Vec3 &x_trans, const VoxelCoefficient (&c_inv)[6],
+	bool compute_hessian)
+{
+	double e_x_cov_x = exp (-gauss_d2_ * covarianceForm(c_inv, x_trans) / 2);
+	// calculate probability of transtormed points existance, equation 6.9 [Magnusson 2009]
+	double score_inc = -gauss_d1_ * e_x_cov_x;
+	e_x_cov_x = gauss_d2_ * e_x_cov_x;
+	// error checking for invalid values.
+	if (e_x_cov_x > 1 || e_x_cov_x < 0 || e_x_cov_x != e_x_cov_x)
+		return 0;
+	// equation 6.12 and 6.13 [Magnusson 2009]
+	e_x_cov_x *= gauss_d1_;
+	Vec3 cov_dxd_pi;
+	for (int i = 0; i < 6; i++)
+	{
+		// equation 6.12 and 6.13 [Magnusson 2009]
+		covarianceProduct(c_inv, point_gradient_.data[0][i], point_gradient_.data[1][i], point_gradient_.data[2][i], cov_dxd_pi);
+		double x_cov_dxd_pi = dot_product(x_trans, cov_dxd_pi);
+		// update gradient, Equation 6.12 [Magnusson 2009]
+		score_gradient[i] += x_cov_dxd_pi * e_x_cov_x;
+		if (compute_hessian)
+		{
+			for (int j = 0; j < 6; j++)
+			{
+				Vec3 colVec = { point_gradient_.data[0][j], point_gradient_.data[1][j], point_gradient_.data[2][j] };
+				Vec3 matProd;
+				covarianceProduct(c_inv, colVec[0] + point_hessian_.data[3*i][j], colVec[1] + point_hessian_.data[3*i+1][j],
+					colVec[2] + point_hessian_.data[3*i+2][j], matProd);
+				// Update hessian, Equation 6.13 [Magnusson 2009]
+				hessian.data[i][j] += e_x_cov_x * (-gauss_d2_ * x_cov_dxd_pi *
+									dot_product(x_trans, matProd) +
+									dot_product( colVec, cov_dxd_pi) );
+			}
+		}
+	}
+	return score_inc;
+}
+
+void ndt_mapping::updateHessian (Mat66 &hessian, Vec3 &x_trans, const VoxelCoefficient (&c_inv)[6])
+{
+	// Equation 6.9 [Magnusson 2009]
+	double e_x_cov_x = gauss_d2_ * exp (-gauss_d2_ * covarianceForm(c_inv, x_trans) / 2);
+	// Error checking for invalid values.
+	if (e_x_cov_x > 1 || e_x_cov_x < 0 || e_x_cov_x != e_x_cov_x)
+		return;
+	// Equation 6.12 and 6.13 [Magnusson 2009]
+	e_x_cov_x *= gauss_d1_;
+	Vec3 cov_dxd_pi;
+	for (int i = 0; i < 6; i++)
+	{
+		// Equation 6.12 and 6.13 [Magnusson 2009]
+		covarianceProduct(c_inv, point_gradient_.data[0][i], point_gradient_.data[1][i], point_gradient_.data[2][i], cov_dxd_pi);
+		double x_cov_dxd_pi = dot_product(x_trans, cov_dxd_pi);
+		for (int j = 0; j < 6; j++)
+		{
+			// Update hessian, Equation 6.13 [Magnusson 2009]
+			Vec3 colVec = { point_gradient_.data[0][j], point_gradient_.data[1][j], point_gradient_.data[2][j] };
+			Vec3 matProd;
+			covarianceProduct(c_inv, colVec[0] + point_hessian_.data[3*i][j], colVec[1] + point_hessian_.data[3*i+1][j],
+				colVec[2] + point_hessian_.data[3*i+2][j], matProd);
+			hessian.data[i][j] += e_x_cov_x * (-gauss_d2_ * x_cov_dxd_pi *
+								dot_product(x_trans, matProd) +
+								dot_product( colVec, cov_dxd_pi) );
+		}
+	}
+}
+
 double ndt_mapping::computeDerivatives (Vec6 &score_gradient,
 	Mat66 &hessian,
-	PointCloudSource &trans_cloud,
+	soa_cloud &trans_cloud,
 	Vec6 &p,
 	bool compute_hessian)
 {
@@ -658,10 +1376,8 @@ double ndt_mapping::computeDerivatives (Vec6 &score_gradient,
 	PointXYZI x_pt, x_trans_pt;
 	// Original Point and Transformed Point (for math)
 	Vec3 x, x_trans;
-	// Occupied Voxel
-	Voxel cell;
-	// Inverse Covariance of Occupied Voxel
-	Mat33 c_inv;
+	// Occupied Voxels
+	int neighborhood[MAX_NEAR_VOXELS];
 	// initialization to 0
 	memset(&(score_gradient[0]), 0, sizeof(double) * 6 );
 	memset(&(hessian.data[0][0]), 0, sizeof(double) * 6 * 6);
@@ -671,16 +1387,22 @@ double ndt_mapping::computeDerivatives (Vec6 &score_gradient,
 	// Update gradient and hessian for each point, line 17 in Algorithm 2 [Magnusson 2009]
 	for (size_t idx = 0; idx < input_->size (); idx++)
 	{
-		x_trans_pt = trans_cloud[idx];
+		x_trans_pt = pointAt(trans_cloud, idx);
 
 		// Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
-		std::vector<Voxel> neighborhood;
-		std::vector<float> distances;
-		voxelRadiusSearch (target_cells_, x_trans_pt, resolution_, neighborhood, distances);
+#ifdef EPHOS_TRANSFORM_VOXEL_INDEX
+		int neighbors = voxelNeighborSearch (target_cells_, x_trans_pt, idx, resolution_, neighborhood);
+#else
+		int neighbors = voxelRadiusSearch (target_cells_, x_trans_pt, resolution_, neighborhood);
+#endif
 		
-		for (auto neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
+		for (int n = 0; n < neighbors; n++)
 		{
-			cell = *neighborhood_it;
+#ifdef EPHOS_VOXEL_COEFFICIENTS
+			const VoxelGaussian& cell = target_cells_.gaussians[neighborhood[n]];
+#else
+			const Voxel& cell = target_cells_.cells[neighborhood[n]];
+#endif
 			x_pt = (*input_)[idx];
 			x[0] = x_pt.data[0];
 			x[1] = x_pt.data[1];
@@ -692,12 +1414,10 @@ double ndt_mapping::computeDerivatives (Vec6 &score_gradient,
 			x_trans[0] -= cell.mean[0];
 			x_trans[1] -= cell.mean[1];
 			x_trans[2] -= cell.mean[2];
-			// Uses precomputed covariance for speed.
-			c_inv = cell.invCovariance;
 			// Equations 6.18 and 6.20 [Magnusson 2009]
 			computePointDerivatives (x);
 			// Equations 6.10, 6.12 and 6.13, respectively [Magnusson 2009]
-			score += updateDerivatives (score_gradient, hessian, x_trans, c_inv, compute_hessian);
+			score += updateDerivatives (score_gradient, hessian, x_trans, cell.invCovariance, compute_hessian);
 
 		}
 	}
@@ -1014,7 +1734,7 @@ void ndt_mapping::buildTransformationMatrix(Matrix4f &matrix, Vec6 transform)
 
 double ndt_mapping::computeStepLengthMT (const Vec6 &x, Vec6 &step_dir, double step_init, double step_max,
 	double step_min, double &score, Vec6 &score_gradient, Mat66 &hessian,
-	PointCloudSource &trans_cloud)
+	soa_cloud &trans_cloud)
 {
 	// Set the value of phi(0), Equation 1.3 [More, Thuente 1994]
 	double phi_0 = -score;
@@ -1060,7 +1780,7 @@ double ndt_mapping::computeStepLengthMT (const Vec6 &x, Vec6 &step_dir, double s
 
 	buildTransformationMatrix(final_transformation_, x_t);
 	// New transformed point cloud
-	transformPointCloud (*input_, trans_cloud, final_transformation_);
+	transformScan (*input_, trans_cloud, final_transformation_);
 	// Updates score, gradient and hessian.  Hessian calculation is unessisary but testing showed that most step calculations use the
 	// initial step suggestion and recalculation the reusable portions of the hessian would intail more computation time.
 	score = computeDerivatives (score_gradient, hessian, trans_cloud, x_t, true);
@@ -1096,7 +1816,7 @@ double ndt_mapping::computeStepLengthMT (const Vec6 &x, Vec6 &step_dir, double s
 		buildTransformationMatrix(final_transformation_, x_t); 
 		// New transformed point cloud
 		// Done on final cloud to prevent wasted computation
-		transformPointCloud (*input_, trans_cloud, final_transformation_);
+		transformScan (*input_, trans_cloud, final_transformation_);
 		// Updates score, gradient. Values stored to prevent wasted computation.
 		score = computeDerivatives (score_gradient, hessian, trans_cloud, x_t, false);
 		// Calculate phi(alpha_t+)
@@ -1172,7 +1892,7 @@ void ndt_mapping::eulerAngles(Matrix4f trans, Vec3 &result)
 	result[2] = -res[2];
 }
 
-void ndt_mapping::computeTransformation(PointCloud &output, const Matrix4f &guess)
+void ndt_mapping::computeTransformation(soa_cloud &output, const Matrix4f &guess)
 {
 	nr_iterations_ = 0;
 	converged_ = false;
@@ -1186,7 +1906,7 @@ void ndt_mapping::computeTransformation(PointCloud &output, const Matrix4f &gues
 	// Initialise final transformation to the guessed one
 	final_transformation_ = guess;
 	// Apply guessed transformation prior to search for neighbours
-	transformPointCloud (output, output, guess);
+	transformScan (*input_, output, guess);
 	// Initialize Point Gradient and Hessian
 	memset(point_gradient_.data, 0, sizeof(double) * 3 * 6);
 	point_gradient_.data[0][0] = 1.0;
@@ -1194,7 +1914,7 @@ void ndt_mapping::computeTransformation(PointCloud &output, const Matrix4f &gues
 	point_gradient_.data[2][2] = 1.0;
 	memset(point_hessian_.data, 0, sizeof(double) * 18 * 6);
 	// Convert initial guess matrix to 6 element transformation vector
-	Vec6 p, delta_p, score_gradient;
+	Vec6 p;
 	// TODO: index 4 or 3 ? - original is 4, though nvcc reports out of range on that
 	p[0] = final_transformation_.data[0][3];
 	p[1] = final_transformation_.data[1][3];
@@ -1204,22 +1924,33 @@ void ndt_mapping::computeTransformation(PointCloud &output, const Matrix4f &gues
 	p[3] = ea[0];
 	p[4] = ea[1];
 	p[5] = ea[2];
-	
+	double score = (this->*solver_) (output, p);
+	// store transformation probability
+	// the realtive differences within each scan registration are accurate
+	// but the normalization constants need to be modified for it to be globally accurate
+	trans_probability_ = score / static_cast<double> (input_->size ());
+}
+
+double ndt_mapping::solveNewton (soa_cloud &trans_cloud, Vec6 &p)
+{
+	Vec6 delta_p, score_gradient;
 	Mat66 hessian;
-	double score = 0;
 	double delta_p_norm;
 	// calculate derivates of initial transform vector
 	// subsequent derivative calculations are done in the step length determination
-	score = computeDerivatives (score_gradient, hessian, output, p);
+	double score = computeDerivatives (score_gradient, hessian, trans_cloud, p);
 	while (!converged_)
 	{
+#ifdef EPHOS_SOLVER_STATISTICS
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+#endif
 		// store previous transformation
 		previous_transformation_ = transformation_;
 		// solve for decent direction using newton method, line 23 in Algorithm 2 [Magnusson 2009]
 		// negative for maximization
 		Vec6 neg_grad = {-score_gradient[0], -score_gradient[1], -score_gradient[2],
 					-score_gradient[3], -score_gradient[4], -score_gradient[5]};
-		solve (delta_p, hessian, neg_grad);
+		solveStep (delta_p, hessian, neg_grad);
 
 		// Calculate step length with guarnteed sufficient decrease [More, Thuente 1994]
 		delta_p_norm = sqrt(delta_p[0] * delta_p[0] +
@@ -1231,9 +1962,8 @@ void ndt_mapping::computeTransformation(PointCloud &output, const Matrix4f &gues
 		delta_p_norm = 1;
 		if (delta_p_norm == 0 || delta_p_norm != delta_p_norm)
 		{
-			trans_probability_ = score / static_cast<double> (input_->size ());
 			converged_ = delta_p_norm == delta_p_norm;
-			return;
+			return score;
 		}
 		delta_p[0] /= delta_p_norm;
 		delta_p[1] /= delta_p_norm;
@@ -1242,7 +1972,7 @@ void ndt_mapping::computeTransformation(PointCloud &output, const Matrix4f &gues
 		delta_p[4] /= delta_p_norm;
 		delta_p[5] /= delta_p_norm;
 		
-		delta_p_norm = computeStepLengthMT (p, delta_p, delta_p_norm, step_size_, transformation_epsilon_ / 2, score, score_gradient, hessian, output);
+		delta_p_norm = computeStepLengthMT (p, delta_p, delta_p_norm, step_size_, transformation_epsilon_ / 2, score, score_gradient, hessian, trans_cloud);
 		delta_p[0] *= delta_p_norm;
 		delta_p[1] *= delta_p_norm;
 		delta_p[2] *= delta_p_norm;
@@ -1264,13 +1994,106 @@ void ndt_mapping::computeTransformation(PointCloud &output, const Matrix4f &gues
 			converged_ = true;
 		}
 		nr_iterations_++;
+#ifdef EPHOS_SOLVER_STATISTICS
+		recordIteration (start);
+#endif
 	}
-	// store transformation probability
-	// the realtive differences within each scan registration are accurate
-	// but the normalization constants need to be modified for it to be globally accurate
-	trans_probability_ = score / static_cast<double> (input_->size ());
+	return score;
 }
 
+double ndt_mapping::solveLevenbergMarquardt (soa_cloud &trans_cloud, Vec6 &p)
+{
+	// damping relative to the hessian diagonal, lowered after successful steps
+	double lambda = LM_INITIAL_DAMPING;
+	Vec6 score_gradient, trial_gradient;
+	// the trial steps leave the hessian out, but it is cleared along with the gradient
+	Mat66 hessian, unused_hessian;
+	// the transformation vector reproduces the guess only approximately,
+	// so the trial steps are compared with the transformation built from it
+	buildTransformationMatrix(final_transformation_, p);
+	transformScan (*input_, trans_cloud, final_transformation_);
+	double score = computeDerivatives (score_gradient, hessian, trans_cloud, p);
+	while (!converged_)
+	{
+#ifdef EPHOS_SOLVER_STATISTICS
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+#endif
+		// store previous transformation
+		previous_transformation_ = transformation_;
+		// negative for maximization
+		Vec6 neg_grad = {-score_gradient[0], -score_gradient[1], -score_gradient[2],
+					-score_gradient[3], -score_gradient[4], -score_gradient[5]};
+		Vec6 delta_p, p_t;
+		double trial_score = score;
+		bool accepted = false;
+		for (int trial = 0; trial < LM_MAX_TRIALS && !accepted; trial++)
+		{
+			// the score is maximized with a negative definite hessian,
+			// so the damping is subtracted from the diagonal
+			Mat66 damped = hessian;
+			for (int i = 0; i < 6; i++)
+				damped.data[i][i] -= lambda * std::fabs(hessian.data[i][i]);
+			solveStep (delta_p, damped, neg_grad);
+			for (int i = 0; i < 6; i++)
+				p_t[i] = p[i] + delta_p[i];
+			buildTransformationMatrix(final_transformation_, p_t);
+			transformScan (*input_, trans_cloud, final_transformation_);
+			// the trial steps only need score and gradient
+			trial_score = computeDerivatives (trial_gradient, unused_hessian, trans_cloud, p_t, false);
+			accepted = trial_score > score;
+			if (accepted)
+				lambda /= LM_DAMPING_FACTOR;
+			else
+				lambda *= LM_DAMPING_FACTOR;
+		}
+		double delta_p_norm = 0.0;
+		if (accepted)
+		{
+			memcpy(p, p_t, sizeof(Vec6));
+			memcpy(score_gradient, trial_gradient, sizeof(Vec6));
+			score = trial_score;
+			buildTransformationMatrix(transformation_, delta_p);
+			delta_p_norm = sqrt(dot_product6(delta_p, delta_p));
+			// hessian of the accepted transformation for the next iteration,
+			// trans_cloud still holds the accepted trial step
+			computeHessian (hessian, trans_cloud, p);
+		}
+		else
+		{
+			// no improvement within the trial steps, stay at the current transformation
+			buildTransformationMatrix(final_transformation_, p);
+			converged_ = true;
+		}
+		if (nr_iterations_ > max_iterations_ ||
+			(nr_iterations_ && (std::fabs (delta_p_norm) < transformation_epsilon_)))
+		{
+			converged_ = true;
+		}
+		nr_iterations_++;
+#ifdef EPHOS_SOLVER_STATISTICS
+		recordIteration (start);
+#endif
+	}
+	return score;
+}
+
+void ndt_mapping::solveStep (Vec6 &delta_p, const Mat66 &hessian, const Vec6 &neg_grad)
+{
+#ifdef EPHOS_CAPTURE_SYSTEMS
+	writeSystem(capture_file_, hessian, neg_grad);
+#endif
+	solve (delta_p, hessian, neg_grad);
+}
+
+#ifdef EPHOS_SOLVER_STATISTICS
+void ndt_mapping::recordIteration (std::chrono::high_resolution_clock::time_point start)
+{
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+	solver_iterations_++;
+	solver_seconds_ += elapsed.count();
+}
+#endif
+
 /**
  * Helper function for simple matrix inversion using the determinant
  */
@@ -1299,15 +2122,55 @@ void invertMatrix(Mat33 &m)
 			m.data[row][col] = temp.data[row][col] * invDet;
 }
 
+/**
+ * Computes mean and inverse covariance of a voxel from the sums of its points,
+ * which are expected in the mean and inverse covariance fields.
+ * The covariance is normalized with the cell count of the dense grid.
+ */
+void finishVoxel(Voxel& cell, size_t dense_size)
+{
+	Vec3 pointSum = {cell.mean[0], cell.mean[1], cell.mean[2]};
+	cell.mean[0] /= cell.numberPoints;
+	cell.mean[1] /= cell.numberPoints;
+	cell.mean[2] /= cell.numberPoints;
+	// finish the inverted covariance matrix
+	for (int row = 0; row < 3; row++)
+		for (int col = 0; col < 3; col++)
+		{
+			cell.invCovariance.data[row][col] = (cell.invCovariance.data[row][col] -
+				2 * (pointSum[row] * cell.mean[col])) / dense_size +
+				cell.mean[row]*cell.mean[col];
+			cell.invCovariance.data[row][col] *= (dense_size -1.0) / cell.numberPoints;
+		}
+	invertMatrix(cell.invCovariance);
+}
+
+/**
+ * Copies mean and inverse covariance of a finished voxel into its compact form.
+ * The entries below and above the diagonal are averaged.
+ */
+void compactVoxel(const Voxel& cell, VoxelGaussian& gaussian)
+{
+	const Mat33& c_inv = cell.invCovariance;
+	for (int i = 0; i < 3; i++)
+	{
+		gaussian.mean[i] = cell.mean[i];
+		gaussian.invCovariance[i] = c_inv.data[i][i];
+	}
+	gaussian.invCovariance[3] = (c_inv.data[0][1] + c_inv.data[1][0]) / 2;
+	gaussian.invCovariance[4] = (c_inv.data[0][2] + c_inv.data[2][0]) / 2;
+	gaussian.invCovariance[5] = (c_inv.data[1][2] + c_inv.data[2][1]) / 2;
+}
+
 void ndt_mapping::initCompute()
 {
 	// measure the cloud
 	minVoxel = (*target_)[0];
 	maxVoxel = (*target_)[0];
 
-	for (int i = 1; i < target_->size(); i++)
+	for (int elem = 0; elem < 3; elem++)
 	{
-		for (int elem = 0; elem < 3; elem++)
+		for (int i = 1; i < target_->size(); i++)
 		{
 			if ( (*target_)[i].data[elem] > maxVoxel.data[elem] )
 			maxVoxel.data[elem] = (*target_)[i].data[elem];
@@ -1322,73 +2185,202 @@ void ndt_mapping::initCompute()
 	}
 
 	// initialize the voxel grid
-	// spans over the point cloud
-	target_cells_.clear();
-	target_cells_.resize(voxelDimension[0] * voxelDimension[1] * voxelDimension[2]);
-	for (int i = 0; i < target_cells_.size(); i++)
-	{
-		target_cells_[i].numberPoints = 0;
-		target_cells_[i].mean[0] = 0;
-		target_cells_[i].mean[1] = 0;
-		target_cells_[i].mean[2] = 0;
-		memset(target_cells_[i].invCovariance.data, 0, sizeof(double) * 3 * 3);
-		target_cells_[i].invCovariance.data[2][0] = 1.0;
-		target_cells_[i].invCovariance.data[1][1] = 1.0;
-		target_cells_[i].invCovariance.data[0][2] = 1.0;
-	}
+	// spans over the point cloud, but only occupied cells are stored
+	target_cells_.dense_size = (size_t)voxelDimension[0] * voxelDimension[1] * voxelDimension[2];
+	target_cells_.cells.clear();
+#ifdef EPHOS_INCREMENTAL_MAP
+	target_cells_.sums.clear();
+#endif
+	size_t slotNo = 16;
+	while (slotNo < 2 * target_->size())
+		slotNo *= 2;
+	VoxelSlot emptySlot = { -1, 0 };
+	target_cells_.slots.assign(slotNo, emptySlot);
 
 	// assign the points to their respective voxel
 	for (int i = 0; i < target_->size(); i++)
 	{
-		int voxelIndex = linearizeCoord( (*target_)[i].data[0], (*target_)[i].data[1], (*target_)[i].data[2]);
-		
-		target_cells_[voxelIndex].mean[0] += (*target_)[i].data[0];
-		target_cells_[voxelIndex].mean[1] += (*target_)[i].data[1];
-		target_cells_[voxelIndex].mean[2] += (*target_)[i].data[2];
-		target_cells_[voxelIndex].numberPoints++;
+		const float* point = (*target_)[i].data;
+		Voxel& cell = target_cells_.cells[insertVoxel(target_cells_,
+			linearizeCoord(point[0], point[1], point[2]))];
+		cell.mean[0] += point[0];
+		cell.mean[1] += point[1];
+		cell.mean[2] += point[2];
+		cell.numberPoints++;
 		// sum up for single pass covariance calculation
 		for (int row = 0; row < 3; row ++)
 		for (int col = 0; col < 3; col ++)
-			target_cells_[voxelIndex].invCovariance.data[row][col] += (*target_)[i].data[row] * (*target_)[i].data[col];
+			cell.invCovariance.data[row][col] += point[row] * point[col];
 	}
 	// finish the voxel grid
 	// perform normalization
-	for (int i = 0; i < target_cells_.size(); i++)
+	for (int i = 0; i < target_cells_.cells.size(); i++)
+		finishVoxel(target_cells_.cells[i], target_cells_.dense_size);
+#ifdef EPHOS_INCREMENTAL_MAP
+	// the voxels are finished already, their running sums are not used
+	for (VoxelSums& sums : target_cells_.sums)
+		sums.generation = target_cells_.generation;
+#endif
+#ifdef EPHOS_MORTON_ORDER
+	sortVoxels(target_cells_);
+#endif
+#ifdef EPHOS_VOXEL_COEFFICIENTS
+	target_cells_.gaussians.resize(target_cells_.cells.size());
+	for (int i = 0; i < target_cells_.cells.size(); i++)
+		compactVoxel(target_cells_.cells[i], target_cells_.gaussians[i]);
+#endif
+}
+
+void ndt_mapping::updateMap()
+{
+	// the map continues the previous one if the caller appended to it
+	bool continued = mapped_count_ > 0 &&
+		target_->begin() == mapped_begin_ && target_->size() >= mapped_count_;
+	size_t first = continued ? mapped_count_ : 0;
+	if (!continued)
 	{
-		Vec3 pointSum = {target_cells_[i].mean[0], target_cells_[i].mean[1], target_cells_[i].mean[2]};
-		target_cells_[i].mean[0] /= target_cells_[i].numberPoints;
-		target_cells_[i].mean[1] /= target_cells_[i].numberPoints;
-		target_cells_[i].mean[2] /= target_cells_[i].numberPoints;
-		// finish the inverted covariance matrix
-		for (int row = 0; row < 3; row++)
-			for (int col = 0; col < 3; col++)
-			{
-				target_cells_[i].invCovariance.data[row][col] = (target_cells_[i].invCovariance.data[row][col] -
-					2 * (pointSum[row] * target_cells_[i].mean[col])) / target_cells_.size() +
-					target_cells_[i].mean[row]*target_cells_[i].mean[col];
-				target_cells_[i].invCovariance.data[row][col] *= (target_cells_.size() -1.0) / target_cells_[i].numberPoints; 
-			}
-		invertMatrix(target_cells_[i].invCovariance);
+		map_min_ = (*target_)[0];
+		map_max_ = (*target_)[0];
+	}
+	// measure the added points
+	PointXYZI previous_min = map_min_;
+	for (size_t i = first; i < target_->size(); i++)
+	{
+		for (int elem = 0; elem < 3; elem++)
+		{
+			if ( (*target_)[i].data[elem] > map_max_.data[elem] )
+			map_max_.data[elem] = (*target_)[i].data[elem];
+			if ( (*target_)[i].data[elem] < map_min_.data[elem] )
+			map_min_.data[elem] = (*target_)[i].data[elem];
+		}
+	}
+	// the voxel borders are aligned to the lower end of the map
+	// so the map has to be built anew if it grows below it
+	if (previous_min.data[0] != map_min_.data[0] ||
+		previous_min.data[1] != map_min_.data[1] ||
+		previous_min.data[2] != map_min_.data[2])
+	{
+		continued = false;
+		first = 0;
+	}
+	if (!continued)
+	{
+		// start over with an empty map
+		target_cells_.cells.clear();
+		target_cells_.sums.clear();
+		size_t slotNo = 16;
+		while (slotNo < 2 * target_->size())
+			slotNo *= 2;
+		VoxelSlot emptySlot = { -1, 0 };
+		target_cells_.slots.assign(slotNo, emptySlot);
+	}
+	for (int i = 0; i < 3; i++) {
+		minVoxel.data[i] = map_min_.data[i] - 0.01f;
+		maxVoxel.data[i] = map_max_.data[i] + 0.01f;
+		voxelDimension[i] = (maxVoxel.data[i] - minVoxel.data[i]) / resolution_ + 1;
+	}
+	// a different grid extend changes the normalization of all voxels
+	size_t dense_size = (size_t)voxelDimension[0] * voxelDimension[1] * voxelDimension[2];
+	if (dense_size != target_cells_.dense_size)
+	{
+		target_cells_.dense_size = dense_size;
+		target_cells_.generation++;
+	}
+	// add the points to the running sums of their voxels
+	// the voxels are finished on their next use
+	for (size_t i = first; i < target_->size(); i++)
+	{
+		const PointXYZI& point = (*target_)[i];
+		VoxelSums& sums = target_cells_.sums[insertVoxel(target_cells_,
+			linearizeCoord(point.data[0], point.data[1], point.data[2]))];
+		sums.pointSum[0] += point.data[0];
+		sums.pointSum[1] += point.data[1];
+		sums.pointSum[2] += point.data[2];
+		sums.numberPoints++;
+		for (int row = 0; row < 3; row ++)
+		for (int col = 0; col < 3; col ++)
+			sums.productSum.data[row][col] += point.data[row] * point.data[col];
+		sums.generation = -1;
 	}
+#ifdef EPHOS_MORTON_ORDER
+	// voxels added to an extended map are appended
+	if (!continued)
+		sortVoxels(target_cells_);
+#endif
+#ifdef EPHOS_VOXEL_COEFFICIENTS
+	// the compact gaussians are written when the voxels are finished
+	target_cells_.gaussians.resize(target_cells_.cells.size());
+#endif
+	mapped_begin_ = target_->begin();
+	mapped_count_ = target_->size();
+}
+
+inline void ndt_mapping::refreshVoxel(VoxelGrid& grid, int idx)
+{
+	VoxelSums& sums = grid.sums[idx];
+	if (sums.generation == grid.generation)
+		return;
+	Voxel& cell = grid.cells[idx];
+	memcpy(cell.mean, sums.pointSum, sizeof(Vec3));
+	cell.invCovariance = sums.productSum;
+	cell.numberPoints = sums.numberPoints;
+	finishVoxel(cell, grid.dense_size);
+#ifdef EPHOS_VOXEL_COEFFICIENTS
+	compactVoxel(cell, grid.gaussians[idx]);
+#endif
+	sums.generation = grid.generation;
 }
 
 void ndt_mapping::ndt_align (const Matrix4f& guess)
 {
-	PointCloud output;
+#ifdef EPHOS_MORTON_ORDER
+	// process the points in the order of the voxels they fall into
+	sortMorton(*input_, resolution_, sorted_input_);
+	sorted_input_view_.elements = sorted_input_.data();
+	sorted_input_view_.count = sorted_input_.size();
+	input_ = &sorted_input_view_;
+#endif
+	Matrix4f level_guess = guess;
+#if EPHOS_RESOLUTION_LEVELS > 1
+	// align with coarser voxel grids first, each level starts from the result of the previous one
+	// the grid of the finest level is kept aside, as the incremental map continues it
+	float fine_resolution = resolution_;
+	std::swap(target_cells_, coarse_cells_);
+	for (int level = EPHOS_RESOLUTION_LEVELS - 1; level > 0; level--)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		resolution_ = fine_resolution * (1 << level);
+		initCompute ();
+		alignLevel (level_guess);
+		level_iterations_[level] += nr_iterations_;
+		level_guess = final_transformation_;
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		level_seconds_[level] += elapsed.count();
+	}
+	std::swap(target_cells_, coarse_cells_);
+	resolution_ = fine_resolution;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+#endif
+#ifdef EPHOS_INCREMENTAL_MAP
+	updateMap ();
+#else
 	initCompute ();
-	// Resize the output dataset
-	output.resize (input_->size ());
-	// Copy the point data to output
-	for (size_t i = 0; i < input_->size (); ++i)
-		output[i] = (*input_)[i];
+#endif
+	alignLevel (level_guess);
+#if EPHOS_RESOLUTION_LEVELS > 1
+	level_iterations_[0] += nr_iterations_;
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+	level_seconds_[0] += elapsed.count();
+#endif
+}
+
+void ndt_mapping::alignLevel (const Matrix4f& guess)
+{
 	// Perform the actual transformation computation
+	// the transformed coordinates are written to trans_columns_
 	converged_ = false;
 	final_transformation_ = transformation_ = previous_transformation_ = Matrix4f_Identity;
-	// Right before we estimate the transformation, we set all the point.data[3] values to 1 
-	// to aid the rigid transformation
-	for (size_t i = 0; i < input_->size (); ++i)
-		output[i].data[3] = 1.0;
-	computeTransformation (output, guess);
+	computeTransformation (trans_columns_, guess);
 }
 
 /**
@@ -1402,10 +2394,60 @@ double distance_sqr(const PointXYZI& a, const PointXYZI& b)
 	return dx*dx + dy*dy + dz*dz;
 }
 
-CallbackResult ndt_mapping::partial_points_callback(PointCloud &input_cloud, Matrix4f &init_guess, PointCloud& target_cloud)
+const PointCloudView& ndt_mapping::filterScan(const PointCloudView& cloud, float leaf_size)
+{
+	filtered_scan_.clear();
+	if (!cloud.empty())
+	{
+		PointXYZI minPoint = cloud[0];
+		for (const PointXYZI& point : cloud)
+			for (int elem = 0; elem < 3; elem++)
+				if (point.data[elem] < minPoint.data[elem])
+					minPoint.data[elem] = point.data[elem];
+		// sort the points by the morton code of their voxel
+		// so that the points of each voxel are consecutive
+		filter_order_.resize(cloud.size());
+		for (size_t i = 0; i < cloud.size(); i++)
+		{
+			int x = (cloud[i].data[0] - minPoint.data[0]) / leaf_size;
+			int y = (cloud[i].data[1] - minPoint.data[1]) / leaf_size;
+			int z = (cloud[i].data[2] - minPoint.data[2]) / leaf_size;
+			filter_order_[i] = std::make_pair(mortonCode(x, y, z), (int)i);
+		}
+		std::sort(filter_order_.begin(), filter_order_.end());
+		filter_starts_.clear();
+		for (size_t i = 0; i < cloud.size(); i++)
+			if (i == 0 || filter_order_[i].first != filter_order_[i - 1].first)
+				filter_starts_.push_back(i);
+		filter_starts_.push_back(cloud.size());
+		// replace the points of each voxel by their centroid
+		size_t voxelNo = filter_starts_.size() - 1;
+		filtered_scan_.resize(voxelNo);
+		for (size_t v = 0; v < voxelNo; v++)
+		{
+			double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+			for (size_t i = filter_starts_[v]; i < filter_starts_[v + 1]; i++)
+				for (int elem = 0; elem < 4; elem++)
+					sum[elem] += cloud[filter_order_[i].second].data[elem];
+			size_t pointNo = filter_starts_[v + 1] - filter_starts_[v];
+			for (int elem = 0; elem < 4; elem++)
+				filtered_scan_[v].data[elem] = sum[elem] / pointNo;
+		}
+	}
+	filtered_scan_view_.elements = filtered_scan_.data();
+	filtered_scan_view_.count = filtered_scan_.size();
+	return filtered_scan_view_;
+}
+
+CallbackResult ndt_mapping::partial_points_callback(const PointCloudView &input_cloud, Matrix4f &init_guess, const PointCloudView& target_cloud)
 {
 	CallbackResult result;
+#ifdef EPHOS_LEAF_SIZE
+	// reduce the scan to one point per voxel first
+	input_ = &filterScan(input_cloud, EPHOS_LEAF_SIZE);
+#else
 	input_ = &input_cloud;
+#endif
 	target_ = &target_cloud;
 	ndt_align(init_guess);
 	result.final_transformation = final_transformation_;
@@ -1413,38 +2455,70 @@ CallbackResult ndt_mapping::partial_points_callback(PointCloud &input_cloud, Mat
 	return result;
 }
 
+void ndt_mapping::compute_batch(TestcaseBatch& batch)
+{
+	for (int i = 0; i < batch.count; i++)
+	{
+		// actual kernel invocation
+		batch.results[i] = partial_points_callback(batch.filtered_scan_ptr[i], batch.init_guess[i], batch.maps[i]);
+		testcase_func();
+	}
+}
+
 void ndt_mapping::run(int p) {
 	// prepare to read the first data set
 	pause_func();
 	while (read_testcases < testcases)
 	{
 		// read the next data set while paused
-		int count = read_next_testcases(p);
+		read_next_testcases(p);
 		// resume kernel runtime measurement
 		unpause_func();
-		for (int i = 0; i < count; i++)
-		{
-			// actual kernel invocation
-			results[i] = partial_points_callback(filtered_scan_ptr[i], init_guess[i], maps[i]);
-		}
+		compute_batch(current_batch);
 		// pause and compare results to reference
 		pause_func();
-		check_next_outputs(count);
+		check_next_outputs();
 	}
 }
 
-void ndt_mapping::check_next_outputs(int count)
+void ndt_mapping::run_pipelined(int p) {
+	// measure only the computation stage
+	pause_func();
+	TestcaseBatch batches[PIPELINE_BATCHES];
+	run_pipeline(batches, PIPELINE_BATCHES,
+		[this, p](TestcaseBatch& batch) {
+			return read_batch(batch, p) > 0;
+		},
+		[this](TestcaseBatch& batch) {
+			unpause_func();
+			compute_batch(batch);
+			pause_func();
+		},
+		[this](TestcaseBatch& batch) {
+			check_batch(batch);
+		});
+	for (int i = 0; i < PIPELINE_BATCHES; i++)
+		free_batch(batches[i]);
+}
+
+void ndt_mapping::check_next_outputs()
+{
+	check_batch(current_batch);
+}
+
+void ndt_mapping::check_batch(TestcaseBatch& batch)
 {
 	CallbackResult reference;
-	for (int i = 0; i < count; i++)
+	for (int i = 0; i < batch.count; i++)
 	{
 		try {
+			output_file.seek_testcase(batch.first + i);
 			parseResult(output_file, &reference);
-		} catch (std::ios_base::failure& e) {
+		} catch (const std::ios_base::failure& e) {
 			std::cerr << e.what() << std::endl;
 			exit(-3);
 		}
-		if (results[i].converged != reference.converged)
+		if (batch.results[i].converged != reference.converged)
 		{
 			error_so_far = true;
 		}
@@ -1452,13 +2526,13 @@ void ndt_mapping::check_next_outputs(int count)
 		for (int h = 0; h < 4; h++) {
 			// test for nan
 			for (int w = 0; w < 4; w++) {
-				if (std::isnan(results[i].final_transformation.data[h][w]) !=
+				if (std::isnan(batch.results[i].final_transformation.data[h][w]) !=
 					std::isnan(reference.final_transformation.data[h][w])) {
 					error_so_far = true;
 				}
 			}
 			// compare translation
-			float delta = std::fabs(results[i].final_transformation.data[h][3] -
+			float delta = std::fabs(batch.results[i].final_transformation.data[h][3] -
 				reference.final_transformation.data[h][3]);
 			if (delta > max_delta) {
 				max_delta = delta;
@@ -1479,7 +2553,7 @@ void ndt_mapping::check_next_outputs(int count)
 		};
 		for (int h = 0; h < 4; h++) {
 			for (int w = 0; w < 4; w++) {
-				resPoint.data[h] += results[i].final_transformation.data[h][w]*origin.data[w];
+				resPoint.data[h] += batch.results[i].final_transformation.data[h][w]*origin.data[w];
 				refPoint.data[h] += reference.final_transformation.data[h][w]*origin.data[w];
 			}
 		}
@@ -1502,6 +2576,15 @@ bool ndt_mapping::check_output() {
 	output_file.close();
 	// check for error
 	std::cout << "max delta: " << max_delta << "\n";
+#if EPHOS_RESOLUTION_LEVELS > 1
+	for (int level = EPHOS_RESOLUTION_LEVELS - 1; level >= 0; level--)
+		std::cout << "resolution " << resolution_ * (1 << level) << ": " << level_iterations_[level]
+			<< " iterations, " << level_seconds_[level] << " seconds\n";
+#endif
+#ifdef EPHOS_SOLVER_STATISTICS
+	if (solver_iterations_ > 0)
+		std::cout << "seconds per solver iteration: " << solver_seconds_ / solver_iterations_ << "\n";
+#endif
 	return !error_so_far;
 }
 
@@ -0,0 +1,151 @@
+/**
+ * Times the linear solvers of ndt_mapping on systems captured from real runs.
+ *
+ * The systems are written by a kernel built with NDT_CAPTURE_SYSTEMS.
+ * Every system is solved with gaussian elimination and with solve(),
+ * which decomposes symmetric definite systems as LDL^T.
+ * The captured hessians are not symmetric, so the decomposition is timed
+ * and checked on the symmetric parts of the systems as well.
+ * License: Apache 2.0 (see attachached File)
+ */
+#include "solver.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// number of times each system is solved per measurement
+#define BENCHMARK_REPETITIONS 100000
+// largest relative residual of a solution that is compared with the decomposition
+#define SOLVED_RESIDUAL 1e-9
+
+/**
+ * Linear system captured from a solver step.
+ */
+typedef struct LinearSystem {
+	Mat66 A;
+	Vec6 b;
+} LinearSystem;
+
+typedef void (*SolverFunction)(Vec6& result, const Mat66& A, const Vec6& b);
+
+void solveDecomposed(Vec6& result, const Mat66& A, const Vec6& b)
+{
+	solveLDLT(result, A.data, b);
+}
+
+/**
+ * Measures the average time of one solve over the given systems.
+ * return: nanoseconds per solve
+ */
+double timeSolver(SolverFunction solver, const std::vector<LinearSystem>& systems)
+{
+	Vec6 result;
+	double checksum = 0.0;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < BENCHMARK_REPETITIONS; r++)
+		for (const LinearSystem& system : systems)
+		{
+			solver(result, system.A, system.b);
+			checksum += result[r % 6];
+		}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+	// keeps the solves from being optimized away
+	if (checksum != checksum)
+		std::cout << "invalid results\n";
+	return elapsed.count()*1e9/BENCHMARK_REPETITIONS/systems.size();
+}
+
+/**
+ * Computes the largest entry of Ax - b relative to the largest entry of b.
+ */
+double relativeResidual(const LinearSystem& s, const Vec6& x)
+{
+	double residual = 0.0, norm = 0.0;
+	for (int i = 0; i < 6; i++)
+	{
+		double sum = -s.b[i];
+		for (int j = 0; j < 6; j++)
+			sum += s.A.data[i][j]*x[j];
+		residual = std::max(residual, std::fabs(sum));
+		norm = std::max(norm, std::fabs(s.b[i]));
+	}
+	return residual/norm;
+}
+
+/**
+ * Compares the decomposition with the elimination on the systems it applies to.
+ * The elimination does not exchange the rows of b, so its solutions are only compared
+ * where their residual shows that they solve the system.
+ * definite: receives the systems that are decomposed
+ */
+void compareSolutions(const char* name, const std::vector<LinearSystem>& systems, std::vector<LinearSystem>& definite)
+{
+	double max_difference = 0.0, max_residual = 0.0, max_pivoting_residual = 0.0;
+	int compared = 0;
+	for (const LinearSystem& s : systems)
+	{
+		Vec6 pivoting, decomposed;
+		if (!isSymmetric(s.A.data) || !solveLDLT(decomposed, s.A.data, s.b))
+			continue;
+		definite.push_back(s);
+		max_residual = std::max(max_residual, relativeResidual(s, decomposed));
+		solvePivoting(pivoting, s.A, s.b);
+		double pivoting_residual = relativeResidual(s, pivoting);
+		max_pivoting_residual = std::max(max_pivoting_residual, pivoting_residual);
+		if (pivoting_residual > SOLVED_RESIDUAL)
+			continue;
+		compared++;
+		for (int i = 0; i < 6; i++)
+			max_difference = std::max(max_difference,
+				std::fabs(pivoting[i] - decomposed[i])/std::max(std::fabs(pivoting[i]), 1e-12));
+	}
+	std::cout << name << ": " << definite.size() << " of " << systems.size() << " symmetric and definite\n";
+	if (definite.empty())
+		return;
+	std::cout << "  max relative residual: LDL^T " << max_residual << ", pivoting " << max_pivoting_residual << "\n";
+	std::cout << "  max relative difference where the elimination solves the system (" << compared << "): "
+		<< max_difference << "\n";
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: \n" << argv[0] << " FILE...\n"
+			<< "  FILE   linear systems written by a kernel built with NDT_CAPTURE_SYSTEMS=FILE\n";
+		return 2;
+	}
+	std::vector<LinearSystem> systems, symmetric, definite, definite_symmetric;
+	for (int i = 1; i < argc; i++)
+	{
+		std::ifstream input(argv[i], std::ios::binary);
+		if (!input)
+		{
+			std::cerr << "Error opening " << argv[i] << std::endl;
+			return -3;
+		}
+		LinearSystem system;
+		while (readSystem(input, system.A, system.b))
+			systems.push_back(system);
+	}
+	// symmetric part 0.5*(A + A^T) of every system
+	for (const LinearSystem& s : systems)
+	{
+		LinearSystem sym = s;
+		for (int i = 0; i < 6; i++)
+			for (int j = 0; j < 6; j++)
+				sym.A.data[i][j] = 0.5*(s.A.data[i][j] + s.A.data[j][i]);
+		symmetric.push_back(sym);
+	}
+	compareSolutions("captured systems", systems, definite);
+	compareSolutions("symmetric parts", symmetric, definite_symmetric);
+	std::cout << "all systems, ns per solve: pivoting " << timeSolver(solvePivoting, systems)
+		<< ", solve " << timeSolver(solve, systems) << "\n";
+	if (!definite_symmetric.empty())
+		std::cout << "definite symmetric parts, ns per solve: pivoting " << timeSolver(solvePivoting, definite_symmetric)
+			<< ", LDL^T " << timeSolver(solveDecomposed, definite_symmetric) << "\n";
+	return 0;
+}
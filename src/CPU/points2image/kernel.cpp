@@ -5,37 +5,57 @@
  */
 #include "benchmark.h"
 #include "datatypes.h"
+#include "mapped_file.h"
+#include "pipeline.h"
+#include "pooled_array.h"
 #include <cmath>
 #include <iostream>
-#include <fstream>
 #include <cstring>
 #include <ios>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define EPHOS_X86_SIMD
+#endif
 
 // maximum allowed deviation from the reference results
 #define MAX_EPS 0.001
 
+/**
+ * Input data and results of testcases that are processed in one iteration.
+ */
+typedef struct {
+	// index of the first testcase
+	int first = 0;
+	// number of testcases
+	int count = 0;
+	// the point clouds to process
+	pooled_array<PointCloud2> pointcloud2;
+	// the associated camera extrinsic matrices
+	pooled_array<Mat44> cameraExtrinsicMat;
+	// the associated camera intrinsic matrices
+	pooled_array<Mat33> cameraMat;
+	// distance coefficients
+	pooled_array<Vec5> distCoeff;
+	// image sizes
+	pooled_array<ImageSize> imageSize;
+	// algorithm results
+	pooled_array<PointsImage> results;
+	// pixel values of the results
+	pooled_array<pooled_array<float>> planes;
+} TestcaseBatch;
+
 class points2image : public kernel {
 private:
 	// the number of testcases read
 	int read_testcases = 0;
-	// testcase and reference data streams
-	std::ifstream input_file, output_file;
+	// testcase and reference data files
+	mapped_file input_file, output_file;
 	// whether critical deviation from the reference data has been detected
 	bool error_so_far = false;
 	// deviation from the reference data
 	double max_delta = 0.0;
-	// the point clouds to process in one iteration
-	PointCloud2* pointcloud2 = nullptr;
-	// the associated camera extrinsic matrices
-	Mat44* cameraExtrinsicMat = nullptr;
-	// the associated camera intrinsic matrices
-	Mat33* cameraMat = nullptr;
-	// distance coefficients for the current iteration
-	Vec5* distCoeff = nullptr;
-	// image sizes for the current iteration
-	ImageSize* imageSize = nullptr;
-	// Algorithm results for the current iteration
-	PointsImage* results = nullptr;
+	// testcases processed in the current iteration
+	TestcaseBatch current_batch;
 public:
 	/*
 	 * Initializes the kernel. Must be called before run().
@@ -46,6 +66,12 @@ public:
 	 * p: number of testcases to process in one step
 	 */
 	virtual void run(int p = 1);
+	/**
+	 * Performs the kernel operations on all input and output data,
+	 * while reading and comparing data on separate threads.
+	 * p: number of testcases to process in one step
+	 */
+	virtual void run_pipelined(int p = 1);
 	/**
 	 * Finally checks whether all input data has been processed successfully.
 	 */
@@ -59,162 +85,198 @@ protected:
 	*/
 	virtual int read_next_testcases(int count);
 	/**
-	 * Compares the results from the algorithm with the reference data.
-	 * count: the number of testcases processed 
+	 * Compares the results from the algorithm with the reference data of the current batch.
+	 */
+	virtual void check_next_outputs();
+	/**
+	 * Reads the next test cases into a batch, replacing its previous contents.
+	 * batch: the batch to fill
+	 * count: the number of testcases to read
+	 * returns: the number of testcases actually read
 	 */
-	virtual void check_next_outputs(int count);
+	int read_batch(TestcaseBatch& batch, int count);
+	/**
+	 * Runs the algorithm for each testcase of a batch.
+	 */
+	void compute_batch(TestcaseBatch& batch);
+	/**
+	 * Compares the results of a batch with the reference data.
+	 */
+	void check_batch(TestcaseBatch& batch);
+	/**
+	 * Releases the memory held by a batch.
+	 */
+	void free_batch(TestcaseBatch& batch);
 	/**
 	 * Reads the number of testcases in the data set.
 	 */
-	int read_number_testcases(std::ifstream& input_file);
+	int read_number_testcases(mapped_file& input_file);
 	
 };
 /**
- * Parses the next point cloud from the input stream.
+ * Parses the next point cloud from the input file.
+ * The point data refers to the mapped input file.
  */
-void  parsePointCloud(std::ifstream& input_file, PointCloud2* pointcloud2) {
+void  parsePointCloud(mapped_file& input_file, PointCloud2* pointcloud2) {
 	try {
-		input_file.read((char*)&(pointcloud2->height), sizeof(int32_t));
-		input_file.read((char*)&(pointcloud2->width), sizeof(int32_t));
-		input_file.read((char*)&(pointcloud2->point_step), sizeof(uint32_t));
-		pointcloud2->data = new float[pointcloud2->height * pointcloud2->width * pointcloud2->point_step];
-		input_file.read((char*)pointcloud2->data, pointcloud2->height * pointcloud2->width * pointcloud2->point_step);
-    }  catch (std::ifstream::failure) {
+		pointcloud2->height = input_file.read<int32_t>();
+		pointcloud2->width = input_file.read<int32_t>();
+		pointcloud2->point_step = input_file.read<int32_t>();
+		size_t bytes = (size_t)pointcloud2->height * pointcloud2->width * pointcloud2->point_step;
+		pointcloud2->data = input_file.read_array<float>(bytes/sizeof(float)).elements;
+		input_file.skip(bytes % sizeof(float));
+	}  catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading the next point cloud.");
-    }
+	}
 }
 /**
  * Parses the next camera extrinsic matrix.
  */
-void  parseCameraExtrinsicMat(std::ifstream& input_file, Mat44* cameraExtrinsicMat) {
+void  parseCameraExtrinsicMat(mapped_file& input_file, Mat44* cameraExtrinsicMat) {
 	try {
-		for (int h = 0; h < 4; h++)
-			for (int w = 0; w < 4; w++)
-				input_file.read((char*)&(cameraExtrinsicMat->data[h][w]),sizeof(double));
-	} catch (std::ifstream::failure) {
-		throw std::ios_base::failure("Error reading the next extrinsic matrix.");		
+		*cameraExtrinsicMat = input_file.read<Mat44>();
+	} catch (const std::ios_base::failure&) {
+		throw std::ios_base::failure("Error reading the next extrinsic matrix.");
 	}
 }
 /**
  * Parses the next camera matrix.
  */
-void parseCameraMat(std::ifstream& input_file, Mat33* cameraMat ) {
+void parseCameraMat(mapped_file& input_file, Mat33* cameraMat ) {
 	try {
-	for (int h = 0; h < 3; h++)
-		for (int w = 0; w < 3; w++)
-			input_file.read((char*)&(cameraMat->data[h][w]), sizeof(double));
-	} catch (std::ifstream::failure) {
+		*cameraMat = input_file.read<Mat33>();
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading the next camera matrix.");
-    }
+	}
 }
 /**
  * Parses the next distance coefficients.
  */
-void  parseDistCoeff(std::ifstream& input_file, Vec5* distCoeff) {
+void  parseDistCoeff(mapped_file& input_file, Vec5* distCoeff) {
 	try {
-		for (int w = 0; w < 5; w++)
-			input_file.read((char*)&(distCoeff->data[w]), sizeof(double));
-	} catch (std::ifstream::failure) {
+		*distCoeff = input_file.read<Vec5>();
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading the next set of distance coefficients.");
 	}
 }
 /**
  * Parses the next image sizes.
  */
-void  parseImageSize(std::ifstream& input_file, ImageSize* imageSize) {
+void  parseImageSize(mapped_file& input_file, ImageSize* imageSize) {
 	try {
-		input_file.read((char*)&(imageSize->width), sizeof(int32_t));
-		input_file.read((char*)&(imageSize->height), sizeof(int32_t));
-	} catch (std::ifstream::failure) {
+		imageSize->width = input_file.read<int32_t>();
+		imageSize->height = input_file.read<int32_t>();
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading the next image size.");
 	}
 }
 /**
  * Parses the next reference image.
+ * The pixel data refers to the mapped reference file.
  */
-void parsePointsImage(std::ifstream& output_file, PointsImage* goldenResult) {
+void parsePointsImage(mapped_file& output_file, PointsImageView* goldenResult) {
 	try {
 		// read data of static size
-		output_file.read((char*)&(goldenResult->image_width), sizeof(int32_t));
-		output_file.read((char*)&(goldenResult->image_height), sizeof(int32_t));
-		output_file.read((char*)&(goldenResult->max_y), sizeof(int32_t));
-		output_file.read((char*)&(goldenResult->min_y), sizeof(int32_t));
-		int pos = 0;
+		goldenResult->image_width = output_file.read<int32_t>();
+		goldenResult->image_height = output_file.read<int32_t>();
+		goldenResult->max_y = output_file.read<int32_t>();
+		goldenResult->min_y = output_file.read<int32_t>();
+		// refer to data of variable size
 		int elements = goldenResult->image_height * goldenResult->image_width;
-		goldenResult->intensity = new float[elements];
-		goldenResult->distance = new float[elements];
-		goldenResult->min_height = new float[elements];
-		goldenResult->max_height = new float[elements];
-		// read data of variable size
-		for (int h = 0; h < goldenResult->image_height; h++)
-			for (int w = 0; w < goldenResult->image_width; w++)
-			{
-				output_file.read((char*)&(goldenResult->intensity[pos]), sizeof(float));
-				output_file.read((char*)&(goldenResult->distance[pos]), sizeof(float));
-				output_file.read((char*)&(goldenResult->min_height[pos]), sizeof(float));
-				output_file.read((char*)&(goldenResult->max_height[pos]), sizeof(float));
-				pos++;
-			}
-	} catch (std::ios_base::failure) {
+		goldenResult->pixels = output_file.read_array<float>(elements*4).elements;
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading the next reference image.");
 	}
 }
+/**
+ * Records the start of every testcase in the input and reference data files.
+ */
+void indexTestcases(mapped_file& input_file, mapped_file& output_file, int testcases) {
+	for (int i = 0; i < testcases; i++)
+	{
+		try {
+			input_file.add_testcase();
+			// point cloud
+			int32_t height = input_file.read<int32_t>();
+			int32_t width = input_file.read<int32_t>();
+			int32_t point_step = input_file.read<int32_t>();
+			input_file.skip((size_t)height*width*point_step);
+			// matrices, distance coefficients and image size
+			input_file.skip(sizeof(Mat44) + sizeof(Mat33) + sizeof(Vec5) + 2*sizeof(int32_t));
+		} catch (const std::ios_base::failure&) {
+			throw std::ios_base::failure("Error indexing the input data file.");
+		}
+		try {
+			output_file.add_testcase();
+			int32_t width = output_file.read<int32_t>();
+			int32_t height = output_file.read<int32_t>();
+			// extent and pixel data
+			output_file.skip(2*sizeof(int32_t) + (size_t)width*height*4*sizeof(float));
+		} catch (const std::ios_base::failure&) {
+			throw std::ios_base::failure("Error indexing the output data file.");
+		}
+	}
+}
 
 
-int points2image::read_next_testcases(int count)
+void points2image::free_batch(TestcaseBatch& batch)
 {
-	// free the memory that has been allocated in the previous iteration
-	// and allocate new for the currently required data sizes
-	if (pointcloud2) 
-		for (int m = 0; m < count; ++m)
-			delete [] pointcloud2[m].data;
-	delete [] pointcloud2;
-	pointcloud2 = new PointCloud2[count];
-	delete [] cameraExtrinsicMat;
-	cameraExtrinsicMat = new Mat44[count];
-	delete [] cameraMat;
-	cameraMat = new Mat33[count];
-	delete [] distCoeff;
-	distCoeff = new Vec5[count];
-	delete [] imageSize;
-	imageSize = new ImageSize[count];
-	if (results)
-	for (int m = 0; m < count; ++m)
-	{
-		delete [] results[m].intensity;
-		delete [] results[m].distance;
-		delete [] results[m].min_height;
-		delete [] results[m].max_height;
-	}
-	delete [] results;
-	results = new PointsImage[count];
+	// point data is part of the mapped input file
+	batch.pointcloud2.release();
+	batch.cameraExtrinsicMat.release();
+	batch.cameraMat.release();
+	batch.distCoeff.release();
+	batch.imageSize.release();
+	batch.results.release();
+	batch.planes.release();
+	batch.count = 0;
+}
+
+int points2image::read_batch(TestcaseBatch& batch, int count)
+{
+	// reuse the memory of the previous iteration
+	// and only allocate new if more testcases are read at once
+	batch.pointcloud2.acquire(count);
+	batch.cameraExtrinsicMat.acquire(count);
+	batch.cameraMat.acquire(count);
+	batch.distCoeff.acquire(count);
+	batch.imageSize.acquire(count);
+	batch.results.acquire(count);
+	batch.planes.acquire(count);
+	batch.first = read_testcases;
 	
 	// iteratively read the data for the test cases
 	int i;
 	for (i = 0; (i < count) && (read_testcases < testcases); i++,read_testcases++)
 	{
 		try {
-			parsePointCloud(input_file, pointcloud2 + i);
-			parseCameraExtrinsicMat(input_file, cameraExtrinsicMat + i);
-			parseCameraMat(input_file, cameraMat + i);
-			parseDistCoeff(input_file, distCoeff + i);
-			parseImageSize(input_file, imageSize + i);
-		} catch (std::ios_base::failure& e) {
+			input_file.seek_testcase(read_testcases);
+			parsePointCloud(input_file, &batch.pointcloud2[i]);
+			parseCameraExtrinsicMat(input_file, &batch.cameraExtrinsicMat[i]);
+			parseCameraMat(input_file, &batch.cameraMat[i]);
+			parseDistCoeff(input_file, &batch.distCoeff[i]);
+			parseImageSize(input_file, &batch.imageSize[i]);
+		} catch (const std::ios_base::failure& e) {
 			std::cerr << e.what() << std::endl;
 			exit(-3);
 		}
 	}
-
+	batch.count = i;
 	return i;
 }
 
-int points2image::read_number_testcases(std::ifstream& input_file)
+int points2image::read_next_testcases(int count)
+{
+	return read_batch(current_batch, count);
+}
+
+int points2image::read_number_testcases(mapped_file& input_file)
 {
 	// reads the number of testcases in the data stream
 	int32_t number;
 	try {
-		input_file.read((char*)&(number), sizeof(int32_t));
-	} catch (std::ifstream::failure) {
+		number = input_file.read<int32_t>();
+	} catch (const std::ios_base::failure&) {
 		throw std::ios_base::failure("Error reading the number of testcases.");
 	}
 
@@ -224,25 +286,25 @@ int points2image::read_number_testcases(std::ifstream& input_file)
 void points2image::init() {
 	std::cout << "init\n";
 	
-	// open testcase and reference data streams
-	input_file.exceptions ( std::ifstream::failbit | std::ifstream::badbit );
-	output_file.exceptions ( std::ifstream::failbit | std::ifstream::badbit );
+	// map testcase and reference data files
 	try {
-		input_file.open("../../../data/p2i_input.dat", std::ios::binary);
-	} catch (std::ifstream::failure) {
+		input_file.open("../../../data/p2i_input.dat");
+	} catch (const std::ios_base::failure&) {
 		std::cerr << "Error opening the input data file" << std::endl;
 		exit(-2);
 	}
 	try {
-		output_file.open("../../../data/p2i_output.dat", std::ios::binary);
-	} catch (std::ifstream::failure) {
+		output_file.open("../../../data/p2i_output.dat");
+	} catch (const std::ios_base::failure&) {
 		std::cerr << "Error opening the output data file" << std::endl;
 		exit(-2);
 	}
 	try {
-	// consume the total number of testcases
+		// consume the total number of testcases
+		// and find the start of every testcase
 		testcases = read_number_testcases(input_file);
-	} catch (std::ios_base::failure& e) {
+		indexTestcases(input_file, output_file, testcases);
+	} catch (const std::ios_base::failure& e) {
 		std::cerr << e.what() << std::endl;
 		exit(-3);
 	}
@@ -250,15 +312,247 @@ void points2image::init() {
 	// prepare the first iteration
 	error_so_far = false;
 	max_delta = 0.0;
-	pointcloud2 = nullptr;
-	cameraExtrinsicMat = nullptr;
-	cameraMat = nullptr;
-	distCoeff = nullptr;
-	imageSize = nullptr;
-	results = nullptr;
+	free_batch(current_batch);
 
 	std::cout << "done\n" << std::endl;
 }
+/**
+ * Writes a projected point into the image if no nearer point has been written to its pixel.
+ * msg: the resulting image
+ * px, py: pixel coordinates of the projected point
+ * distance: the scaled depth of the point
+ * intensity: the intensity of the point
+ */
+inline void drawPoint(PointsImage& msg, int px, int py, float distance, float intensity)
+{
+	// target pixel index linearization
+	int pid = py * msg.image_width + px;
+	// replace unset pixels as well as pixels with a higher distance value
+	if(msg.distance[pid] == 0 ||
+		msg.distance[pid] >= distance)
+	{
+		// make the result always deterministic and independent from the point order
+		// in case two points get the same distance, take the one with higher intensity
+		if (((msg.distance[pid] == distance) &&  msg.intensity[pid] < intensity) ||
+			(msg.distance[pid] > distance) ||
+			msg.distance[pid] == 0) 
+		{
+			msg.intensity[pid] = intensity;
+		}
+		msg.distance[pid] = distance;
+		msg.min_height[pid] = -1.25;
+		msg.max_height[pid] = 0;
+		// update image usage extends
+		msg.max_y = py > msg.max_y ? py : msg.max_y;
+		msg.min_y = py < msg.min_y ? py : msg.min_y;
+	}
+}
+
+/**
+ * Transforms and projects a range of cloud points and draws them into the image.
+ * cloud: coordinates and intensities of the points to transform
+ * begin, end: range of points to process
+ * invR: inverse camera rotation
+ * invT: inverse camera translation
+ * cameraMat: camera matrix used for transformation
+ * distCoeff: distance coefficients for cloud transformation
+ * msg: the resulting image
+ */
+void projectPoints(
+	const PointRecordView& cloud, int begin, int end,
+	const Mat33& invR, const Mat13& invT,
+	const Mat33& cameraMat, const Vec5& distCoeff,
+	PointsImage& msg)
+{
+	int w = msg.image_width;
+	int h = msg.image_height;
+	for (int n = begin; n < end; n++) {
+		double intensity = cloud.intensity(n);
+
+		Mat13 point, point2;
+		point2.data[0] = double(cloud.x(n));
+		point2.data[1] = double(cloud.y(n));
+		point2.data[2] = double(cloud.z(n));
+		
+		// start the the predetermined translation
+		for (int row = 0; row < 3; row++) {
+			point.data[row] = invT.data[row];
+		// add the transformed cloud point
+		for (int col = 0; col < 3; col++) 
+			point.data[row] += point2.data[col] * invR.data[row][col];
+		}
+		// discard points with small depth values
+		if (point.data[2] <= 2.5) {
+			continue;
+		}
+		// perform perspective division
+		double tmpx = point.data[0]/point.data[2];
+		double tmpy = point.data[1]/point.data[2];
+		// apply the distance coefficients
+		double r2 = tmpx * tmpx + tmpy * tmpy;
+		double tmpdist = 1 + distCoeff.data[0] * r2
+		+ distCoeff.data[1] * r2 * r2
+		+ distCoeff.data[4] * r2 * r2 * r2;
+
+		Point2d imagepoint;
+		imagepoint.x = tmpx * tmpdist
+		+ 2 * distCoeff.data[2] * tmpx * tmpy
+		+ distCoeff.data[3] * (r2 + 2 * tmpx * tmpx);
+		imagepoint.y = tmpy * tmpdist
+		+ distCoeff.data[2] * (r2 + 2 * tmpy * tmpy)
+		+ 2 * distCoeff.data[3] * tmpx * tmpy;
+		
+		// apply the camera matrix (camera intrinsics) and end up with a two dimensional point
+		imagepoint.x = cameraMat.data[0][0] * imagepoint.x + cameraMat.data[0][2];
+		imagepoint.y = cameraMat.data[1][1] * imagepoint.y + cameraMat.data[1][2];
+		int px = int(imagepoint.x + 0.5);
+		int py = int(imagepoint.y + 0.5);
+		
+		// continue with points that landed inside image bounds
+		if(0 <= px && px < w && 0 <= py && py < h)
+		{
+			drawPoint(msg, px, py, float(point.data[2] * 100.0), float(intensity));
+		}
+	}
+}
+
+#if defined(EPHOS_X86_SIMD)
+/**
+ * Transforms and projects four points held in vector registers.
+ * Operations are performed in the same order as in projectPoints() to yield identical results.
+ * Writes the pixel coordinates and distances of the points and returns a mask of the points to draw.
+ */
+__attribute__((target("avx2")))
+inline int projectPointsAVX2x4(
+	__m256d x, __m256d y, __m256d z,
+	const Mat33& invR, const Mat13& invT,
+	const Mat33& cameraMat, const Vec5& distCoeff,
+	int w, int h, int* px, int* py, double* distance)
+{
+	// rotation and translation
+	__m256d p[3];
+	for (int row = 0; row < 3; row++) {
+		p[row] = _mm256_set1_pd(invT.data[row]);
+		p[row] = _mm256_add_pd(p[row], _mm256_mul_pd(x, _mm256_set1_pd(invR.data[row][0])));
+		p[row] = _mm256_add_pd(p[row], _mm256_mul_pd(y, _mm256_set1_pd(invR.data[row][1])));
+		p[row] = _mm256_add_pd(p[row], _mm256_mul_pd(z, _mm256_set1_pd(invR.data[row][2])));
+	}
+	__m256d depth_mask = _mm256_cmp_pd(p[2], _mm256_set1_pd(2.5), _CMP_GT_OQ);
+	// skip the projection if all points are too close
+	if (_mm256_movemask_pd(depth_mask) == 0)
+		return 0;
+	// perspective division
+	__m256d tmpx = _mm256_div_pd(p[0], p[2]);
+	__m256d tmpy = _mm256_div_pd(p[1], p[2]);
+	// distortion
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d two = _mm256_set1_pd(2.0);
+	__m256d d0 = _mm256_set1_pd(distCoeff.data[0]);
+	__m256d d1 = _mm256_set1_pd(distCoeff.data[1]);
+	__m256d d2 = _mm256_set1_pd(distCoeff.data[2]);
+	__m256d d3 = _mm256_set1_pd(distCoeff.data[3]);
+	__m256d d4 = _mm256_set1_pd(distCoeff.data[4]);
+	__m256d r2 = _mm256_add_pd(_mm256_mul_pd(tmpx, tmpx), _mm256_mul_pd(tmpy, tmpy));
+	__m256d tmpdist = _mm256_add_pd(one, _mm256_mul_pd(d0, r2));
+	tmpdist = _mm256_add_pd(tmpdist, _mm256_mul_pd(_mm256_mul_pd(d1, r2), r2));
+	tmpdist = _mm256_add_pd(tmpdist, _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(d4, r2), r2), r2));
+	__m256d ix = _mm256_mul_pd(tmpx, tmpdist);
+	ix = _mm256_add_pd(ix, _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(two, d2), tmpx), tmpy));
+	ix = _mm256_add_pd(ix, _mm256_mul_pd(d3, _mm256_add_pd(r2, _mm256_mul_pd(_mm256_mul_pd(two, tmpx), tmpx))));
+	__m256d iy = _mm256_mul_pd(tmpy, tmpdist);
+	iy = _mm256_add_pd(iy, _mm256_mul_pd(d2, _mm256_add_pd(r2, _mm256_mul_pd(_mm256_mul_pd(two, tmpy), tmpy))));
+	iy = _mm256_add_pd(iy, _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(two, d3), tmpx), tmpy));
+	// camera intrinsics
+	ix = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(cameraMat.data[0][0]), ix), _mm256_set1_pd(cameraMat.data[0][2]));
+	iy = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(cameraMat.data[1][1]), iy), _mm256_set1_pd(cameraMat.data[1][2]));
+	ix = _mm256_add_pd(ix, _mm256_set1_pd(0.5));
+	iy = _mm256_add_pd(iy, _mm256_set1_pd(0.5));
+	// image bounds, tested before the conversion to integers to avoid overflows
+	__m256d bounds_mask = _mm256_and_pd(
+		_mm256_and_pd(_mm256_cmp_pd(ix, _mm256_set1_pd(-1.0), _CMP_GT_OQ), _mm256_cmp_pd(ix, _mm256_set1_pd(w), _CMP_LT_OQ)),
+		_mm256_and_pd(_mm256_cmp_pd(iy, _mm256_set1_pd(-1.0), _CMP_GT_OQ), _mm256_cmp_pd(iy, _mm256_set1_pd(h), _CMP_LT_OQ)));
+	int mask = _mm256_movemask_pd(_mm256_and_pd(depth_mask, bounds_mask));
+	// truncate like the integer conversion in projectPoints()
+	_mm_storeu_si128((__m128i*)px, _mm256_cvttpd_epi32(_mm256_and_pd(ix, bounds_mask)));
+	_mm_storeu_si128((__m128i*)py, _mm256_cvttpd_epi32(_mm256_and_pd(iy, bounds_mask)));
+	_mm256_storeu_pd(distance, _mm256_mul_pd(p[2], _mm256_set1_pd(100.0)));
+	return mask;
+}
+
+/**
+ * Loads the coordinates of four consecutive point records into vector registers.
+ * The first four floats of each record are read and transposed, so records need to span at least four floats.
+ */
+__attribute__((target("avx2")))
+inline void loadPointsAVX2x4(const PointRecordView& cloud, int n, __m256d& x, __m256d& y, __m256d& z)
+{
+	__m128 r0 = _mm_loadu_ps((const float*)(cloud.base + (n + 0)*cloud.stride));
+	__m128 r1 = _mm_loadu_ps((const float*)(cloud.base + (n + 1)*cloud.stride));
+	__m128 r2 = _mm_loadu_ps((const float*)(cloud.base + (n + 2)*cloud.stride));
+	__m128 r3 = _mm_loadu_ps((const float*)(cloud.base + (n + 3)*cloud.stride));
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	x = _mm256_cvtps_pd(r0);
+	y = _mm256_cvtps_pd(r1);
+	z = _mm256_cvtps_pd(r2);
+}
+
+/**
+ * Vectorized variant of projectPoints() that processes eight points per iteration.
+ */
+__attribute__((target("avx2")))
+void projectPointsAVX2(
+	const PointRecordView& cloud, int begin, int end,
+	const Mat33& invR, const Mat13& invT,
+	const Mat33& cameraMat, const Vec5& distCoeff,
+	PointsImage& msg)
+{
+	int w = msg.image_width;
+	int h = msg.image_height;
+	int n = begin;
+	// records with less than four floats are left to the scalar code
+	bool wide_records = cloud.stride >= 4*sizeof(float);
+	for (; wide_records && n + 8 <= end; n += 8) {
+		// load the point components from the records
+		__m256d x, y, z;
+		int px[8], py[8];
+		double distance[8];
+		loadPointsAVX2x4(cloud, n, x, y, z);
+		int mask = projectPointsAVX2x4(x, y, z,
+			invR, invT, cameraMat, distCoeff, w, h, px, py, distance);
+		loadPointsAVX2x4(cloud, n + 4, x, y, z);
+		mask |= projectPointsAVX2x4(x, y, z,
+			invR, invT, cameraMat, distCoeff, w, h, px + 4, py + 4, distance + 4) << 4;
+		// draw the points in cloud order
+		for (int i = 0; i < 8; i++)
+			if (mask & (1 << i))
+				drawPoint(msg, px[i], py[i], float(distance[i]), cloud.intensity(n + i));
+	}
+	// remaining points
+	projectPoints(cloud, n, end, invR, invT, cameraMat, distCoeff, msg);
+}
+#endif
+
+/**
+ * Signature of the point projection functions.
+ */
+typedef void (*ProjectionFunction)(
+	const PointRecordView&, int, int,
+	const Mat33&, const Mat13&,
+	const Mat33&, const Vec5&,
+	PointsImage&);
+
+/**
+ * Selects the fastest point projection function supported by the processor.
+ */
+ProjectionFunction selectProjection()
+{
+#if defined(EPHOS_X86_SIMD)
+	if (__builtin_cpu_supports("avx2"))
+		return projectPointsAVX2;
+#endif
+	return projectPoints;
+}
+
 /**
  * This code is extracted from Autoware, file:
  * ~/Autoware/ros/src/sensing/fusion/packages/points2image/lib/points_image/points_image.cpp
@@ -268,34 +562,34 @@ void points2image::init() {
  * cameraMat: camera matrix used for transformation
  * distCoeff: distance coefficients for cloud transformation
  * imageSize: the size of the resulting image
+ * planes: storage for the pixel values, reused between calls
  * returns: the two dimensional image of transformed points
  */
 PointsImage pointcloud2_to_image(
 	const PointCloud2& pointcloud2,
 	const Mat44& cameraExtrinsicMat,
 	const Mat33& cameraMat, const Vec5& distCoeff,
-	const ImageSize& imageSize)
+	const ImageSize& imageSize,
+	pooled_array<float>& planes)
 {
 	// initialize the resulting image data structure
 	int w = imageSize.width;
 	int h = imageSize.height;
 	PointsImage msg;
-	msg.intensity = new float[w*h];
+	float* pixels = planes.acquire(4*(size_t)w*h);
+	msg.intensity = pixels;
 	std::memset(msg.intensity, 0, sizeof(float)*w*h);
-	msg.distance = new float[w*h];
+	msg.distance = pixels + w*h;
 	std::memset(msg.distance, 0, sizeof(float)*w*h);
-	msg.min_height = new float[w*h];
+	msg.min_height = pixels + 2*w*h;
 	std::memset(msg.min_height, 0, sizeof(float)*w*h);
-	msg.max_height = new float[w*h];
+	msg.max_height = pixels + 3*w*h;
 	std::memset(msg.max_height, 0, sizeof(float)*w*h);
 	msg.max_y = -1;
 	msg.min_y = h;
 	msg.image_height = imageSize.height;
 	msg.image_width = imageSize.width;
 	
-	// prepare cloud data pointer to read the data correctly
-	uintptr_t cp = (uintptr_t)pointcloud2.data;
-	
 	// preprocess the given matrices
 	// transposed 3x3 camera extrinsic matrix
 	Mat33 invR;
@@ -309,127 +603,93 @@ PointsImage pointcloud2_to_image(
 		for (int col = 0; col < 3; col++)
 			invT.data[row] -= invR.data[row][col] * cameraExtrinsicMat.data[col][3];
 	}
+	// the point records are read in place
+	int point_num = pointcloud2.height * pointcloud2.width;
+	PointRecordView cloud = { (const char*)pointcloud2.data, (size_t)point_num, (size_t)pointcloud2.point_step };
 	// apply the algorithm for each point in the cloud
-	for (uint32_t y = 0; y < pointcloud2.height; ++y) {
-		for (uint32_t x = 0; x < pointcloud2.width; ++x) {
-			// the start of the current point in the cloud to process
-			float* fp = (float *)(cp + (x + y*pointcloud2.width) * pointcloud2.point_step);
-			double intensity = fp[4];
+	static const ProjectionFunction projection = selectProjection();
+	projection(cloud, 0, point_num, invR, invT, cameraMat, distCoeff, msg);
+	return msg;
+}
 
-			Mat13 point, point2;
-			point2.data[0] = double(fp[0]);
-			point2.data[1] = double(fp[1]);
-			point2.data[2] = double(fp[2]);
-			
-			// start the the predetermined translation
-			for (int row = 0; row < 3; row++) {
-				point.data[row] = invT.data[row];
-			// add the transformed cloud point
-			for (int col = 0; col < 3; col++) 
-				point.data[row] += point2.data[col] * invR.data[row][col];
-			}
-			// discard points with small depth values
-			if (point.data[2] <= 2.5) {
-				continue;
-			}
-			// perform perspective division
-			double tmpx = point.data[0]/point.data[2];
-			double tmpy = point.data[1]/point.data[2];
-			// apply the distance coefficients
-			double r2 = tmpx * tmpx + tmpy * tmpy;
-			double tmpdist = 1 + distCoeff.data[0] * r2
-			+ distCoeff.data[1] * r2 * r2
-			+ distCoeff.data[4] * r2 * r2 * r2;
 
-			Point2d imagepoint;
-			imagepoint.x = tmpx * tmpdist
-			+ 2 * distCoeff.data[2] * tmpx * tmpy
-			+ distCoeff.data[3] * (r2 + 2 * tmpx * tmpx);
-			imagepoint.y = tmpy * tmpdist
-			+ distCoeff.data[2] * (r2 + 2 * tmpy * tmpy)
-			+ 2 * distCoeff.data[3] * tmpx * tmpy;
-			
-			// apply the camera matrix (camera intrinsics) and end up with a two dimensional point
-			imagepoint.x = cameraMat.data[0][0] * imagepoint.x + cameraMat.data[0][2];
-			imagepoint.y = cameraMat.data[1][1] * imagepoint.y + cameraMat.data[1][2];
-			int px = int(imagepoint.x + 0.5);
-			int py = int(imagepoint.y + 0.5);
-			
-			// continue with points that landed inside image bounds
-			if(0 <= px && px < w && 0 <= py && py < h)
-			{
-				// target pixel index linearization
-				int pid = py * w + px;
-				// replace unset pixels as well as pixels with a higher distance value
-				if(msg.distance[pid] == 0 ||
-					msg.distance[pid] >= float(point.data[2] * 100.0))
-				{
-					// make the result always deterministic and independent from the point order
-					// in case two points get the same distance, take the one with higher intensity
-					if (((msg.distance[pid] == float(point.data[2] * 100.0)) &&  msg.intensity[pid] < float(intensity)) ||
-						(msg.distance[pid] > float(point.data[2] * 100.0)) ||
-						msg.distance[pid] == 0) 
-					{
-						msg.intensity[pid] = float(intensity);
-					}
-					msg.distance[pid] = float(point.data[2] * 100.0);
-					msg.min_height[pid] = -1.25;
-					msg.max_height[pid] = 0;
-					// update image usage extends
-					msg.max_y = py > msg.max_y ? py : msg.max_y;
-					msg.min_y = py < msg.min_y ? py : msg.min_y;
-				}
-			}
-		}
+void points2image::compute_batch(TestcaseBatch& batch)
+{
+	// run the algorithm for each input data set
+	for (int i = 0; i < batch.count; i++)
+	{
+		batch.results[i] = pointcloud2_to_image(batch.pointcloud2[i],
+							batch.cameraExtrinsicMat[i],
+							batch.cameraMat[i], batch.distCoeff[i],
+							batch.imageSize[i],
+							batch.planes[i]);
+		testcase_func();
 	}
-	return msg;
 }
 
-
 void points2image::run(int p) {
 	// pause while reading and comparing data
 	// only run the timer when the algorithm is active
 	pause_func();
 	while (read_testcases < testcases)
 	{
-		int count = read_next_testcases(p);
+		read_next_testcases(p);
 		unpause_func();
-		// run the algorithm for each input data set
-		for (int i = 0; i < count; i++)
-		{
-			results[i] = pointcloud2_to_image(pointcloud2[i],
-								cameraExtrinsicMat[i],
-								cameraMat[i], distCoeff[i],
-								imageSize[i]);
-		}
+		compute_batch(current_batch);
 		pause_func();
 		// compare with the reference data
-		check_next_outputs(count);
+		check_next_outputs();
 	}
 }
 
-void points2image::check_next_outputs(int count)
+void points2image::run_pipelined(int p) {
+	// only run the timer in the computation stage
+	pause_func();
+	TestcaseBatch batches[PIPELINE_BATCHES];
+	run_pipeline(batches, PIPELINE_BATCHES,
+		[this, p](TestcaseBatch& batch) {
+			return read_batch(batch, p) > 0;
+		},
+		[this](TestcaseBatch& batch) {
+			unpause_func();
+			compute_batch(batch);
+			pause_func();
+		},
+		[this](TestcaseBatch& batch) {
+			check_batch(batch);
+		});
+	for (int i = 0; i < PIPELINE_BATCHES; i++)
+		free_batch(batches[i]);
+}
+
+void points2image::check_next_outputs()
+{
+	check_batch(current_batch);
+}
+
+void points2image::check_batch(TestcaseBatch& batch)
 {
-	PointsImage reference;
+	PointsImageView reference;
 	// parse the next reference image
 	// and compare it to the data generated by the algorithm
-	for (int i = 0; i < count; i++)
+	for (int i = 0; i < batch.count; i++)
 	{
 		try {
+			output_file.seek_testcase(batch.first + i);
 			parsePointsImage(output_file, &reference);
-		} catch (std::ios_base::failure& e) {
+		} catch (const std::ios_base::failure& e) {
 			std::cerr << e.what() << std::endl;
 			exit(-3);
 		}
 		// detect image size deviation
-		if ((results[i].image_height != reference.image_height)
-			|| (results[i].image_width != reference.image_width))
+		if ((batch.results[i].image_height != reference.image_height)
+			|| (batch.results[i].image_width != reference.image_width))
 		{
 			error_so_far = true;
 		}
 		// detect image extend deviation
-		if ((results[i].min_y != reference.min_y)
-			|| (results[i].max_y != reference.max_y))
+		if ((batch.results[i].min_y != reference.min_y)
+			|| (batch.results[i].max_y != reference.max_y))
 		{
 			error_so_far = true;
 		}
@@ -439,21 +699,17 @@ void points2image::check_next_outputs(int count)
 			for (int w = 0; w < reference.image_width; w++)
 			{
 				// compare members individually and detect deviations
-				if (std::fabs(reference.intensity[pos] - results[i].intensity[pos]) > max_delta)
-					max_delta = fabs(reference.intensity[pos] - results[i].intensity[pos]);
-				if (std::fabs(reference.distance[pos] - results[i].distance[pos]) > max_delta)
-					max_delta = fabs(reference.distance[pos] - results[i].distance[pos]);
-				if (std::fabs(reference.min_height[pos] - results[i].min_height[pos]) > max_delta)
-					max_delta = fabs(reference.min_height[pos] - results[i].min_height[pos]);
-				if (std::fabs(reference.max_height[pos] - results[i].max_height[pos]) > max_delta)
-					max_delta = fabs(reference.max_height[pos] - results[i].max_height[pos]);
+				const float* pixel = reference.pixels + 4*pos;
+				if (std::fabs(pixel[0] - batch.results[i].intensity[pos]) > max_delta)
+					max_delta = fabs(pixel[0] - batch.results[i].intensity[pos]);
+				if (std::fabs(pixel[1] - batch.results[i].distance[pos]) > max_delta)
+					max_delta = fabs(pixel[1] - batch.results[i].distance[pos]);
+				if (std::fabs(pixel[2] - batch.results[i].min_height[pos]) > max_delta)
+					max_delta = fabs(pixel[2] - batch.results[i].min_height[pos]);
+				if (std::fabs(pixel[3] - batch.results[i].max_height[pos]) > max_delta)
+					max_delta = fabs(pixel[3] - batch.results[i].max_height[pos]);
 				pos++;
 			}
-		// free the memory allocated by the reference image read above
-		delete [] reference.intensity;
-		delete [] reference.distance;
-		delete [] reference.min_height;
-		delete [] reference.max_height;
 	}
 }
 
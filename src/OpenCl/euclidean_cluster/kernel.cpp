@@ -45,6 +45,13 @@
 
 #define NUMWORKITEMS_PER_WORKGROUP_STRING STRINGIZE(NUMWORKITEMS_PER_WORKGROUP) 
 
+// number of points whose neighbour flags are packed into one word
+#define NEIGHBOUR_BITS 32
+
+#if NUMWORKITEMS_PER_WORKGROUP % NEIGHBOUR_BITS != 0
+#error "OPENCL_LOCAL_SIZE has to be a multiple of 32"
+#endif
+
 // algorithm parameters
 const int _cluster_size_min = 20;
 const int _cluster_size_max = 100000;
@@ -588,11 +595,13 @@ void extractEuclideanClusters (
 	unsigned int max_pts_per_cluster,
 	OCL_Struct* OCL_objs)
 {
+	// the neighbour matrix rows and the radius search results hold one bit per point
+	int wordCount = (cloudSize + NEIGHBOUR_BITS - 1)/NEIGHBOUR_BITS;
 	// indicates the processed status for each point
-	std::vector<bool> processed (cloudSize, false);
+	std::vector<cl_uint> processed (wordCount, 0);
 	// temporary radius search results
 	cl_int err;
-	cl::Buffer candidateBuffer (OCL_objs->context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, sizeof(int)*cloudSize);
+	cl::Buffer candidateBuffer (OCL_objs->context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, sizeof(cl_uint)*wordCount);
 	
 	// cluster candidate buffer
 	int* seedQueue = new int[cloudSize];
@@ -605,26 +614,32 @@ void extractEuclideanClusters (
 	std::memcpy(tmp_cloud, cloud, sizeof(Point)*cloudSize);
 	OCL_objs->cmdqueue.enqueueUnmapMemObject(cloudBuffer, tmp_cloud);
 	
-	// create and initialize the distance matrix buffer
-	cl::Buffer distanceBuffer (OCL_objs->context, CL_MEM_READ_WRITE, sizeof(bool)*cloudSize*cloudSize);
+	// create and initialize the neighbour bit matrix buffer
+	cl::Buffer distanceBuffer (OCL_objs->context, CL_MEM_READ_WRITE, sizeof(cl_uint)*wordCount*(size_t)cloudSize);
 	size_t offset = 0;
 	size_t local_size     = NUMWORKITEMS_PER_WORKGROUP;
-	size_t workgroup_size = (cloudSize + NUMWORKITEMS_PER_WORKGROUP - 1);
-	size_t global_size    = workgroup_size * local_size;
+	// one work group per tile of the matrix
+	size_t tile_count     = (cloudSize + NUMWORKITEMS_PER_WORKGROUP - 1)/NUMWORKITEMS_PER_WORKGROUP;
+	size_t tile_global_size = tile_count * tile_count * local_size;
+	// one work item per word of a matrix row
+	size_t word_groups    = (wordCount + NUMWORKITEMS_PER_WORKGROUP - 1)/NUMWORKITEMS_PER_WORKGROUP;
+	size_t word_global_size = word_groups * local_size;
 	cl::NDRange offsetRange(offset);
 	cl::NDRange localSizeRange (local_size);
-	cl::NDRange globalSizeRange(global_size);
+	cl::NDRange tileSizeRange(tile_global_size);
+	cl::NDRange wordSizeRange(word_global_size);
 	// call the initialization kernel
 	OCL_objs->kernel_initRS.setArg(0, cloudBuffer);
 	OCL_objs->kernel_initRS.setArg(1, distanceBuffer);
 	OCL_objs->kernel_initRS.setArg(2, cloudSize);
+	OCL_objs->kernel_initRS.setArg(3, wordCount);
 	#if defined (DOUBLE_FP)
-	OCL_objs->kernel_initRS.setArg(3, static_cast<double>(tolerance*tolerance));
+	OCL_objs->kernel_initRS.setArg(4, static_cast<double>(tolerance*tolerance));
 	#else
-	OCL_objs->kernel_initRS.setArg(3, (tolerance*tolerance));
+	OCL_objs->kernel_initRS.setArg(4, (tolerance*tolerance));
 	#endif
 	OCL_objs->cmdqueue.enqueueNDRangeKernel(
-		OCL_objs->kernel_initRS, offsetRange, globalSizeRange, localSizeRange);
+		OCL_objs->kernel_initRS, offsetRange, tileSizeRange, localSizeRange);
 	OCL_objs->kernel_parallelRS.setArg(0, seedQueueBuffer);
 	OCL_objs->kernel_parallelRS.setArg(1, candidateBuffer);
 	OCL_objs->kernel_parallelRS.setArg(2, distanceBuffer);
@@ -632,45 +647,49 @@ void extractEuclideanClusters (
 	for (int i = 0; i < cloudSize; ++i)
 	{
 		// skip elements that have already been looked at
-		if (processed[i])
+		if (processed[i/NEIGHBOUR_BITS] & (1u << (i%NEIGHBOUR_BITS)))
 			continue;
 		// begin a new candidate with one element
 		int iQueueEnd = 0;
 		seedQueue[iQueueEnd++] = i;
-		processed[i] = true;
+		processed[i/NEIGHBOUR_BITS] |= 1u << (i%NEIGHBOUR_BITS);
 		int newElementNo = 1;
 		// grow the candidate until convergence
 		while (newElementNo > 0)
 		{
-			// move the seed queue to device memory
+			// move the new part of the seed queue to device memory
 			OCL_objs->cmdqueue.enqueueWriteBuffer(seedQueueBuffer, CL_TRUE,
-				0, sizeof(int)*cloudSize, seedQueue);
+				sizeof(int)*(iQueueEnd - newElementNo), sizeof(int)*newElementNo, seedQueue + iQueueEnd - newElementNo);
 			// call the radius search kernel
 			OCL_objs->kernel_parallelRS.setArg(3, iQueueEnd - newElementNo);
 			OCL_objs->kernel_parallelRS.setArg(4, iQueueEnd);
-			OCL_objs->kernel_parallelRS.setArg(5, cloudSize);
+			OCL_objs->kernel_parallelRS.setArg(5, wordCount);
 			OCL_objs->cmdqueue.enqueueNDRangeKernel(OCL_objs->kernel_parallelRS, 
 				offsetRange,
-				globalSizeRange,
+				wordSizeRange,
 				localSizeRange);
 
-			// move the indices of near points into host memory
-			bool* canidateStorage = (bool *) OCL_objs->cmdqueue.enqueueMapBuffer(candidateBuffer, CL_TRUE, CL_MAP_READ,
-				0, sizeof(int)*cloudSize);
+			// move the near point bits into host memory
+			cl_uint* candidateStorage = (cl_uint *) OCL_objs->cmdqueue.enqueueMapBuffer(candidateBuffer, CL_TRUE, CL_MAP_READ,
+				0, sizeof(cl_uint)*wordCount);
 			OCL_objs->cmdqueue.finish();
 			newElementNo = 0;
 			// add new near points to the candidate cluster
-			for (size_t j = 0; j < cloudSize; ++j)
+			for (int w = 0; w < wordCount; ++w)
 			{
-				if (canidateStorage[j] == false)
+				cl_uint candidates = candidateStorage[w] & ~processed[w];
+				if (candidates == 0)
 					continue;
-				if (processed[j])
-					continue;
-				seedQueue[iQueueEnd++] = j;
-				processed[j] = true;
-				newElementNo++;
+				processed[w] |= candidates;
+				newElementNo += __builtin_popcount(candidates);
+				// visit the set bits in ascending order
+				while (candidates != 0)
+				{
+					seedQueue[iQueueEnd++] = w*NEIGHBOUR_BITS + __builtin_ctz(candidates);
+					candidates &= candidates - 1;
+				}
 			}
-			OCL_objs->cmdqueue.enqueueUnmapMemObject(candidateBuffer, canidateStorage);
+			OCL_objs->cmdqueue.enqueueUnmapMemObject(candidateBuffer, candidateStorage);
 		}
 		// addd the cluster candidate if it is inside satisfactory size bounds
 		if (iQueueEnd >= min_pts_per_cluster && iQueueEnd <= max_pts_per_cluster)
@@ -8,39 +8,70 @@ typedef struct  {
 } Point;
 
 
+// number of points whose neighbour flags are packed into one word
+#define NEIGHBOUR_BITS 32
+
+#if NUMWORKITEMS_PER_WORKGROUP % NEIGHBOUR_BITS != 0
+#error "NUMWORKITEMS_PER_WORKGROUP has to be a multiple of NEIGHBOUR_BITS"
+#endif
+
 /**
- * Computes the pairwise squared distances. Results are stored in a matrix.
- * An entry of that matrix indicates whether the distance of the two described points 
+ * Computes the pairwise squared distances. Results are stored in a bit matrix.
+ * Each matrix row holds one bit for every point, packed into words of NEIGHBOUR_BITS bits.
+ * A bit indicates whether the distance of the two described points 
  * is less or equal to the reference distance.
+ * Every work group computes a tile of NUMWORKITEMS_PER_WORKGROUP rows and columns,
+ * with the column points of the tile shared in local memory.
  * points: points for which we need pairwise distances with size N
- * sqr_distances: resulting distance matrix of size N*N
- * number_points: distances calculated per work item
+ * neighbours: resulting bit matrix of N rows with word_count words each
+ * number_points: number of points
+ * word_count: number of words per matrix row
  * radius_sqr: reference distance
  */
 __kernel void 
 __attribute__ ((reqd_work_group_size(NUMWORKITEMS_PER_WORKGROUP,1,1)))
 initRadiusSearch(
 	__global const Point* restrict points,
-	__global bool*        restrict sqr_distances,
+	__global uint*        restrict neighbours,
 	int    number_points, 
+	int    word_count,
 	#if defined (DOUBLE_FP)
 	double radius_sqr
 	#else
 	float radius_sqr
 	#endif
 ) {
-	int n = number_points;
-	int j = get_global_id(0);
+	__local Point tile_points[NUMWORKITEMS_PER_WORKGROUP];
+	int tile_count = (number_points + NUMWORKITEMS_PER_WORKGROUP - 1)/NUMWORKITEMS_PER_WORKGROUP;
+	int row_tile = get_group_id(0)/tile_count;
+	int column_tile = get_group_id(0)%tile_count;
+	int local_id = get_local_id(0);
 
-	if (j < number_points) {
-		for (int i = 0; i < number_points; i++)
+	// load the column points of the tile
+	int column_start = column_tile*NUMWORKITEMS_PER_WORKGROUP;
+	if (column_start + local_id < number_points)
+		tile_points[local_id] = points[column_start + local_id];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	int i = row_tile*NUMWORKITEMS_PER_WORKGROUP + local_id;
+	if (i < number_points) {
+		Point point = points[i];
+		int tile_size = min(NUMWORKITEMS_PER_WORKGROUP, number_points - column_start);
+		__global uint* row = neighbours + (size_t)i*word_count + column_start/NEIGHBOUR_BITS;
+		for (int w = 0; w*NEIGHBOUR_BITS < tile_size; w++)
 		{
-			float dx = points[i].x - points[j].x;
-			float dy = points[i].y - points[j].y;
-			float dz = points[i].z - points[j].z;
-			int array_index = i*number_points + j;
-			sqr_distances[array_index] = ((dx*dx + dy*dy + dz*dz) <= radius_sqr );
+			int word_size = min(NEIGHBOUR_BITS, tile_size - w*NEIGHBOUR_BITS);
+			uint bits = 0;
+			for (int b = 0; b < word_size; b++)
+			{
+				Point other = tile_points[w*NEIGHBOUR_BITS + b];
+				float dx = point.x - other.x;
+				float dy = point.y - other.y;
+				float dz = point.z - other.z;
+				if ((dx*dx + dy*dy + dz*dz) <= radius_sqr)
+					bits |= 1u << b;
+			}
+			row[w] = bits;
 		}
 	}
 }
-
@@ -4,51 +4,33 @@
  * License: Apache 2.0 (see attachached File)
  */
 /**
- * Radius search base on a precomputed distance matrix.
- * Near points are marked through the indices array.
- * The search can be executed for multiple reference points.
+ * Radius search base on a precomputed neighbour bit matrix.
+ * Near points are marked through the bits of the indices array.
+ * The search can be executed for multiple reference points,
+ * every work item combines one word of their matrix rows.
  * 
  * point_index: indices of reference points
- * indices: near point marks
- * sqr_distances: precomputed distance matrix
+ * indices: near point marks, one bit per point
+ * neighbours: precomputed neighbour bit matrix
  * start_index: point index to start at
  * search_points: point index to end at
- * cloud_size: number of elements in the point cloud
+ * word_count: number of words per matrix row
  */
 __kernel
 void __attribute__ ((reqd_work_group_size(NUMWORKITEMS_PER_WORKGROUP,1,1)))
 parallelRadiusSearch(
 	__global const int*  restrict point_index,
-	__global       bool* restrict indices, 
-	__global const bool* restrict sqr_distances, 
+	__global       uint* restrict indices, 
+	__global const uint* restrict neighbours, 
 	int start_index, 
 	int search_points, 
-	int cloud_size)
+	int word_count)
 {
 	int id = get_global_id(0);
-	if (id < cloud_size) {
-		bool found = false;
-		bool is_skipped = false;
+	if (id < word_count) {
+		uint found = 0;
 		for (int search_point_index = start_index; search_point_index < search_points; search_point_index++)
-		{
-			if (id == point_index[search_point_index])
-			{
-				found = true;
-				is_skipped = true;
-			} 
-			else
-			{
-				is_skipped = false;
-			}
-			if (!is_skipped) 
-			{
-				int array_index = point_index[search_point_index] * cloud_size+id;;
-				if ( sqr_distances[array_index])
-					found = true;
-			}
-		}
+			found |= neighbours[(size_t)point_index[search_point_index]*word_count + id];
 		indices[id] = found;
 	}
 }
-
-
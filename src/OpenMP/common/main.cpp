@@ -4,10 +4,12 @@
  * License: Apache 2.0 (see attachached File)
  */
 #include <chrono>
+#include <fstream>
 #include <iostream>
 #include <string.h>
 #include <stdlib.h>
 #include "benchmark.h"
+#include "latency.h"
 
 std::chrono::high_resolution_clock::time_point start,end;
 std::chrono::duration<double> elapsed;
@@ -17,6 +19,16 @@ bool pause = false;
 // how many testcases should be executed in sequence (before checking for correctness)
 int pipelined = 1;
 
+// whether reading, computation and comparison overlap
+bool asynchronous = false;
+
+// per testcase runtime measurement
+std::chrono::high_resolution_clock::time_point testcase_start;
+latency_recorder latencies;
+
+// file to write the latency report to
+const char* latency_file = nullptr;
+
 extern kernel& myKernel;
 
 
@@ -31,30 +43,58 @@ void unpause_timer()
 {
   pause = false;
   start = timer.now();
+  testcase_start = start;
+}
+
+void testcase_timer()
+{
+  std::chrono::high_resolution_clock::time_point now = timer.now();
+  latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - testcase_start).count());
+  testcase_start = now;
 }
 
 void usage(char *exec)
 {
-  std::cout << "Usage: \n" << exec << " [-p N]\nOptions:\n  -p N   executes N invocations in sequence,";
+  std::cout << "Usage: \n" << exec << " [-p N] [-a] [-l FILE]\nOptions:\n  -p N   executes N invocations in sequence,";
   std::cout << "before taking time and check the result.\n";
   std::cout << "         Default: N=1\n";
+  std::cout << "  -a     reads the next and checks the previous invocations on separate threads\n";
+  std::cout << "         while the current invocations execute.\n";
+  std::cout << "  -l FILE writes the runtime percentiles and histogram of the individual invocations\n";
+  std::cout << "         to FILE in JSON format.\n";
 }
 int main(int argc, char **argv) {
 
-  if ((argc != 1) && (argc !=  3))
-    {
-      usage(argv[0]);
-      exit(2);
-    }
-  if (argc == 3)
+  for (int i = 1; i < argc; i++)
     {
-      if (strcmp(argv[1], "-p") != 0)
+      if (strcmp(argv[i], "-a") == 0)
+	{
+	  asynchronous = true;
+	  std::cout << "Overlapping data reading, kernel execution and checking\n";
+	  continue;
+	}
+      if (strcmp(argv[i], "-l") == 0)
+	{
+	  if (i + 1 == argc)
+	    {
+	      usage(argv[0]);
+	      exit(2);
+	    }
+	  latency_file = argv[++i];
+	  continue;
+	}
+      if (strcmp(argv[i], "-p") != 0)
 	{
 	  usage(argv[0]);
 	  exit(3);
 	}
+      if (i + 1 == argc)
+	{
+	  usage(argv[0]);
+	  exit(2);
+	}
       errno = 0;
-      pipelined = strtol(argv[2], NULL, 10);
+      pipelined = strtol(argv[++i], NULL, 10);
       if (errno || (pipelined < 1) )
 	{
 	  usage(argv[0]);
@@ -64,24 +104,42 @@ int main(int argc, char **argv) {
       
     }
     // read input data
-    myKernel.set_timer_functions(pause_timer, unpause_timer);
+    myKernel.set_timer_functions(pause_timer, unpause_timer, testcase_timer);
     myKernel.init();
     
     // measure the runtime of the kernel
     start = timer.now();
+    testcase_start = start;
+    std::chrono::high_resolution_clock::time_point total_start = start;
 
     // execute the kernel
-    myKernel.run(pipelined);
+    if (asynchronous)
+      myKernel.run_pipelined(pipelined);
+    else
+      myKernel.run(pipelined);
     
     // measure the runtime of the kernel
+    std::chrono::high_resolution_clock::time_point total_end = timer.now();
     if (!pause) 
     {
-	end = timer.now();
+	end = total_end;
     	elapsed += end-start;
     }
+    // including data reading and checking
+    std::chrono::duration<double> total = total_end - total_start;
     std::cout <<  "elapsed time: "<< elapsed.count() << " seconds, average time per testcase (#"
 	      << myKernel.testcases << "): " << elapsed.count() / (double) myKernel.testcases
 	      << " seconds" << std::endl;
+    std::cout << "end-to-end time: " << total.count() << " seconds, throughput: "
+	      << myKernel.testcases / total.count() << " testcases per second" << std::endl;
+    latencies.write_summary(std::cout);
+    if (latency_file)
+    {
+	std::ofstream latency_report(latency_file);
+	latencies.write_json(latency_report);
+	if (!latency_report)
+	  std::cerr << "Error writing the latency report" << std::endl;
+    }
 
     // read the desired output  and compare
     if (myKernel.check_output())
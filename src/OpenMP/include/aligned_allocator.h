@@ -0,0 +1,51 @@
+/**
+ * Author:  Florian Stock, Technische Universität Darmstadt,
+ * Embedded Systems & Applications Group 2018
+ * License: Apache 2.0 (see attachached File)
+ */
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Allocator for standard containers that places the elements at the given byte boundary.
+ * operator new only guarantees the alignment of the fundamental types before C++17,
+ * which is not enough for elements that are loaded with vector instructions.
+ */
+template<typename T, size_t Alignment>
+class aligned_allocator {
+public:
+	typedef T value_type;
+	template<typename U>
+	struct rebind {
+		typedef aligned_allocator<U, Alignment> other;
+	};
+
+	aligned_allocator() {}
+	template<typename U>
+	aligned_allocator(const aligned_allocator<U, Alignment>&) {}
+
+	T* allocate(size_t n) {
+		void* memory;
+		if (posix_memalign(&memory, Alignment, n*sizeof(T)) != 0)
+			throw std::bad_alloc();
+		return (T*)memory;
+	}
+	void deallocate(T* p, size_t) {
+		std::free(p);
+	}
+};
+
+template<typename T, typename U, size_t Alignment>
+bool operator==(const aligned_allocator<T, Alignment>&, const aligned_allocator<U, Alignment>&) {
+	return true;
+}
+template<typename T, typename U, size_t Alignment>
+bool operator!=(const aligned_allocator<T, Alignment>&, const aligned_allocator<U, Alignment>&) {
+	return false;
+}
+
+#endif
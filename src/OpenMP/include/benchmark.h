@@ -16,6 +16,13 @@ public:
   
   // executes the testcase, in blocks of p at a time
   virtual void run(int p = 1) = 0;
+
+  // executes the testcases like run(), but reads the next block and compares the
+  // previous block while the current one is processed
+  // kernels without a pipelined implementation use run() instead
+  virtual void run_pipelined(int p = 1) {
+    run(p);
+  }
   
   // compares the computed output with the golden reference output
   // output can be read from a file or in a static array
@@ -26,15 +33,20 @@ public:
   uint32_t testcases = 1;
   
   // sets the functions which should be called to pause and unpause the timer
+  // and to mark the end of a testcase
   void set_timer_functions(void (*pause_function)(),
-		            void (*unpause_function)()) {
+		            void (*unpause_function)(),
+		            void (*testcase_function)()) {
      unpause_func = unpause_function;
      pause_func = pause_function;
+     testcase_func = testcase_function;
    }
   
 protected:
   void (*unpause_func)();
   void (*pause_func)();
+  // called after each testcase while the timer runs
+  void (*testcase_func)();
   virtual int read_next_testcases(int count) = 0;
 };
 
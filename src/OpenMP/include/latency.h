@@ -0,0 +1,155 @@
+/**
+ * Author:  Florian Stock, Technische Universität Darmstadt,
+ * Embedded Systems & Applications Group 2018
+ * License: Apache 2.0 (see attachached File)
+ */
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// number of most recent testcase durations that are kept
+#define LATENCY_SAMPLES 65536
+// sub-buckets per power of two in the histogram, as power of two
+#define LATENCY_SUB_BUCKET_BITS 4
+// number of histogram buckets required to cover all 64 bit values
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS)
+
+/**
+ * Records the durations of individual testcases in nanoseconds.
+ * The most recent durations are kept in a ring buffer from which percentiles are computed.
+ * Additionally all durations are counted in a histogram with logarithmic buckets
+ * that are subdivided linearly, like in HDR histograms.
+ */
+class latency_recorder {
+public:
+	/**
+	 * Adds the duration of one testcase.
+	 */
+	void record(uint64_t nanoseconds) {
+		samples[recorded % LATENCY_SAMPLES] = nanoseconds;
+		recorded++;
+		histogram[bucket(nanoseconds)]++;
+		if (nanoseconds < min_value)
+			min_value = nanoseconds;
+		if (nanoseconds > max_value)
+			max_value = nanoseconds;
+	}
+	/**
+	 * Returns the number of recorded durations.
+	 */
+	uint64_t count() const {
+		return recorded;
+	}
+	/**
+	 * Writes minimum, percentiles, maximum and the non-empty histogram buckets in JSON format.
+	 * Percentiles are taken from the most recent LATENCY_SAMPLES durations.
+	 */
+	void write_json(std::ostream& out) const {
+		std::vector<uint64_t> sorted = sorted_samples();
+		out << "{\n";
+		out << "\t\"unit\": \"ns\",\n";
+		out << "\t\"testcases\": " << recorded << ",\n";
+		out << "\t\"percentile_samples\": " << sorted.size() << ",\n";
+		out << "\t\"min\": " << (recorded ? min_value : 0) << ",\n";
+		out << "\t\"p50\": " << percentile(sorted, 0.5) << ",\n";
+		out << "\t\"p90\": " << percentile(sorted, 0.9) << ",\n";
+		out << "\t\"p99\": " << percentile(sorted, 0.99) << ",\n";
+		out << "\t\"p99.9\": " << percentile(sorted, 0.999) << ",\n";
+		out << "\t\"max\": " << max_value << ",\n";
+		out << "\t\"histogram\": [";
+		bool first = true;
+		for (int i = 0; i < LATENCY_BUCKETS; i++)
+		{
+			if (histogram[i] == 0)
+				continue;
+			out << (first ? "\n" : ",\n");
+			out << "\t\t{ \"from\": " << bucket_start(i) << ", \"to\": " << bucket_end(i)
+				<< ", \"count\": " << histogram[i] << " }";
+			first = false;
+		}
+		out << "\n\t]\n}\n";
+	}
+	/**
+	 * Writes minimum, percentiles and maximum in seconds on a single line.
+	 */
+	void write_summary(std::ostream& out) const {
+		std::vector<uint64_t> sorted = sorted_samples();
+		out << "latency per testcase (seconds): min " << (recorded ? min_value : 0)*1e-9
+			<< ", p50 " << percentile(sorted, 0.5)*1e-9
+			<< ", p90 " << percentile(sorted, 0.9)*1e-9
+			<< ", p99 " << percentile(sorted, 0.99)*1e-9
+			<< ", p99.9 " << percentile(sorted, 0.999)*1e-9
+			<< ", max " << max_value*1e-9 << std::endl;
+	}
+private:
+	// the most recent durations
+	uint64_t samples[LATENCY_SAMPLES];
+	// number of durations recorded so far
+	uint64_t recorded = 0;
+	// number of durations in each bucket
+	uint64_t histogram[LATENCY_BUCKETS] = {};
+	// extreme values
+	uint64_t min_value = UINT64_MAX;
+	uint64_t max_value = 0;
+
+	/**
+	 * Computes the histogram bucket of a value.
+	 * Values below 2^LATENCY_SUB_BUCKET_BITS have their own bucket.
+	 * Above, each power of two range is split into 2^LATENCY_SUB_BUCKET_BITS buckets.
+	 */
+	static int bucket(uint64_t value) {
+		const uint64_t sub_buckets = 1 << LATENCY_SUB_BUCKET_BITS;
+		if (value < sub_buckets)
+			return value;
+		int exponent = 63 - __builtin_clzll(value);
+		int shift = exponent - LATENCY_SUB_BUCKET_BITS;
+		return ((shift + 1) << LATENCY_SUB_BUCKET_BITS) + ((value >> shift) & (sub_buckets - 1));
+	}
+	/**
+	 * Computes the smallest value of a bucket.
+	 */
+	static uint64_t bucket_start(int index) {
+		const uint64_t sub_buckets = 1 << LATENCY_SUB_BUCKET_BITS;
+		if (index < (int)sub_buckets)
+			return index;
+		int shift = (index >> LATENCY_SUB_BUCKET_BITS) - 1;
+		return (sub_buckets + (index & (sub_buckets - 1))) << shift;
+	}
+	/**
+	 * Computes the largest value of a bucket.
+	 */
+	static uint64_t bucket_end(int index) {
+		if (index + 1 == LATENCY_BUCKETS)
+			return UINT64_MAX;
+		return bucket_start(index + 1) - 1;
+	}
+	/**
+	 * Returns the durations that are still held by the ring buffer in ascending order.
+	 */
+	std::vector<uint64_t> sorted_samples() const {
+		uint64_t n = std::min<uint64_t>(recorded, LATENCY_SAMPLES);
+		std::vector<uint64_t> sorted(samples, samples + n);
+		std::sort(sorted.begin(), sorted.end());
+		return sorted;
+	}
+	/**
+	 * Selects a percentile with the nearest rank method.
+	 * sorted: durations in ascending order
+	 * fraction: percentile between 0 and 1
+	 */
+	static uint64_t percentile(const std::vector<uint64_t>& sorted, double fraction) {
+		if (sorted.empty())
+			return 0;
+		size_t rank = (size_t)std::ceil(fraction*sorted.size());
+		if (rank < 1)
+			rank = 1;
+		return sorted[rank - 1];
+	}
+};
+
+#endif
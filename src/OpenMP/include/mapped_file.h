@@ -0,0 +1,179 @@
+/**
+ * Author:  Florian Stock, Technische Universität Darmstadt,
+ * Embedded Systems & Applications Group 2018
+ * License: Apache 2.0 (see attachached File)
+ */
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Read-only view of consecutive elements inside a mapped data file.
+ */
+template<typename T>
+struct mapped_array {
+	// first element
+	const T* elements = nullptr;
+	// number of elements
+	size_t count = 0;
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T& operator[](size_t i) const { return elements[i]; }
+	const T* begin() const { return elements; }
+	const T* end() const { return elements + count; }
+};
+
+/**
+ * Maps a binary data file into memory.
+ * Data is consumed sequentially from a read position. Arrays are returned as views
+ * into the mapping, so they are not copied. The start of each testcase can be recorded
+ * once with add_testcase() and returned to later with seek_testcase().
+ * Errors are reported with std::ios_base::failure, like with the file streams.
+ */
+class mapped_file {
+public:
+	mapped_file() {}
+	~mapped_file() {
+		close();
+	}
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+	mapped_file(mapped_file&& other) {
+		*this = std::move(other);
+	}
+	mapped_file& operator=(mapped_file&& other) {
+		if (this != &other) {
+			close();
+			base = other.base;
+			length = other.length;
+			position = other.position;
+			offsets = std::move(other.offsets);
+			other.base = nullptr;
+			other.length = 0;
+			other.position = 0;
+		}
+		return *this;
+	}
+
+	/**
+	 * Maps the given file.
+	 */
+	void open(const char* path) {
+		close();
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			throw std::ios_base::failure("Error opening data file");
+		struct stat status;
+		if (fstat(fd, &status) != 0) {
+			::close(fd);
+			throw std::ios_base::failure("Error measuring data file");
+		}
+		length = status.st_size;
+		if (length > 0) {
+			void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping == MAP_FAILED) {
+				::close(fd);
+				length = 0;
+				throw std::ios_base::failure("Error mapping data file");
+			}
+			// the data is mostly read front to back
+			madvise(mapping, length, MADV_SEQUENTIAL);
+			base = (const char*)mapping;
+		}
+		::close(fd);
+		position = 0;
+		offsets.clear();
+	}
+	/**
+	 * Releases the mapping. All views become invalid.
+	 */
+	void close() {
+		if (base)
+			munmap((void*)base, length);
+		base = nullptr;
+		length = 0;
+		position = 0;
+		offsets.clear();
+	}
+	/**
+	 * Reads a single value at the read position.
+	 */
+	template<typename T>
+	T read() {
+		require(sizeof(T));
+		T value;
+		std::memcpy(&value, base + position, sizeof(T));
+		position += sizeof(T);
+		return value;
+	}
+	/**
+	 * Returns a view of count elements at the read position.
+	 * The elements must be aligned to their type inside the file.
+	 */
+	template<typename T>
+	mapped_array<T> read_array(size_t count) {
+		require(count*sizeof(T));
+		mapped_array<T> result;
+		result.elements = (const T*)(base + position);
+		result.count = count;
+		position += count*sizeof(T);
+		return result;
+	}
+	/**
+	 * Advances the read position.
+	 */
+	void skip(size_t bytes) {
+		require(bytes);
+		position += bytes;
+	}
+	/**
+	 * Records the read position as the start of the next testcase.
+	 */
+	void add_testcase() {
+		offsets.push_back(position);
+	}
+	/**
+	 * Moves the read position to the start of a recorded testcase.
+	 */
+	void seek_testcase(int testcase) {
+		if (testcase < 0 || testcase >= (int)offsets.size())
+			throw std::ios_base::failure("Testcase not found in data file");
+		position = offsets[testcase];
+	}
+	/**
+	 * Returns the number of recorded testcases.
+	 */
+	int indexed_testcases() const {
+		return offsets.size();
+	}
+private:
+	// start of the mapping
+	const char* base = nullptr;
+	// size of the mapping in bytes
+	size_t length = 0;
+	// current read position
+	size_t position = 0;
+	// start positions of the testcases
+	std::vector<size_t> offsets;
+
+	/**
+	 * Tests whether the given number of bytes can be read.
+	 */
+	void require(size_t bytes) const {
+		if (bytes > length - position)
+			throw std::ios_base::failure("Unexpected end of data file");
+	}
+};
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * Author:  Florian Stock, Technische Universität Darmstadt,
+ * Embedded Systems & Applications Group 2018
+ * License: Apache 2.0 (see attachached File)
+ */
+#ifndef SOA_CLOUD_H
+#define SOA_CLOUD_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+// alignment of the point cloud columns in bytes
+#define SOA_ALIGNMENT 64
+// number of floats in one aligned block
+#define SOA_BLOCK (SOA_ALIGNMENT/sizeof(float))
+
+/**
+ * Point coordinates stored as structure of arrays.
+ * The x, y and z values are held in separate columns
+ * that start at SOA_ALIGNMENT byte boundaries, so that they can be processed with vector instructions.
+ * Each column is padded with zeros to a multiple of SOA_BLOCK values.
+ * The storage is kept when the cloud shrinks, so a cloud can be reused without allocations.
+ */
+class soa_cloud {
+public:
+	soa_cloud() {}
+	~soa_cloud() {
+		std::free(storage);
+	}
+	soa_cloud(const soa_cloud&) = delete;
+	soa_cloud& operator=(const soa_cloud&) = delete;
+	soa_cloud(soa_cloud&& other) {
+		*this = std::move(other);
+	}
+	soa_cloud& operator=(soa_cloud&& other) {
+		if (this != &other) {
+			std::free(storage);
+			storage = other.storage;
+			capacity = other.capacity;
+			other.storage = nullptr;
+			other.capacity = 0;
+		}
+		return *this;
+	}
+
+	/**
+	 * Changes the number of points. The values are not preserved.
+	 */
+	void resize(size_t n) {
+		size_t padded = (n + SOA_BLOCK - 1)/SOA_BLOCK*SOA_BLOCK;
+		if (padded > capacity) {
+			std::free(storage);
+			storage = nullptr;
+			capacity = 0;
+			void* memory;
+			if (posix_memalign(&memory, SOA_ALIGNMENT, 3*padded*sizeof(float)) != 0)
+				throw std::bad_alloc();
+			storage = (float*)memory;
+			capacity = padded;
+		}
+		if (!storage)
+			return;
+		// vector loads beyond the last point read zeros
+		for (int column = 0; column < 3; column++)
+			std::memset(storage + column*capacity + n, 0, (padded - n)*sizeof(float));
+	}
+	float* x() { return storage; }
+	float* y() { return storage + capacity; }
+	float* z() { return storage + 2*capacity; }
+	const float* x() const { return storage; }
+	const float* y() const { return storage + capacity; }
+	const float* z() const { return storage + 2*capacity; }
+private:
+	// the three columns one after another
+	float* storage = nullptr;
+	// number of values each column can hold
+	size_t capacity = 0;
+};
+
+#endif
@@ -0,0 +1,177 @@
+/**
+ * Author:  Florian Stock, Technische Universität Darmstadt,
+ * Embedded Systems & Applications Group 2018
+ * License: Apache 2.0 (see attachached File)
+ */
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <ostream>
+
+#include "datatypes.h"
+
+// replaces the zero pivot of a singular matrix in the gaussian elimination
+#define SINGULAR_PIVOT 0.001
+// largest difference between mirrored entries of a matrix that is decomposed as symmetric,
+// relative to the geometric mean of their diagonal entries, which only admits rounding errors.
+// The assembled hessians deviate from their transpose by up to 16% of their largest entry,
+// their lower triangle alone describes a different system.
+#define SYMMETRY_TOLERANCE 1e-12
+
+/**
+ * Solves Ax = b for x with gaussian elimination.
+ * Maybe not as good when handling very ill conditioned systems, but is faster for a 6x6 matrix 
+ * and works well enough in practice. The elimination works on copies of A and b.
+ * The rows of b are not exchanged along with those of A, so the result only solves the system
+ * if no rows are exchanged. The reference results depend on this and it is kept as it is.
+ */
+inline void solvePivoting(Vec6& result, const Mat66& matrix, const Vec6& vector)
+{
+	double pivot;
+	Mat66 A = matrix;
+	Vec6 b;
+	memcpy(b, vector, sizeof(Vec6));
+
+	// bring to upper diagonal
+	for(int j = 0; j < 6; j++)
+	{
+		// search for the biggest entry
+		double max = std::fabs(A.data[j][j]);
+		int mi = j;
+		for (int i = j + 1; i < 6; i++)
+			if (std::fabs(A.data[i][j]) > max)
+			{
+				mi = i;
+				max = std::fabs(A.data[i][j]);
+			}
+		// swap lines mi and j
+		if (mi != j)
+			for (int i = 0; i < 6; i++)
+			{
+				double temp = A.data[mi][i];
+				A.data[mi][i] = A.data[j][i];
+				A.data[j][i] = temp;
+			}
+		if (max == 0.0) {
+			// we have a singular matrix
+			A.data[j][j] = SINGULAR_PIVOT;
+		}
+		// subtract lines to yield a triagonal matrix
+		for (int i = j+1; i < 6; i++)
+		{
+			pivot=A.data[i][j]/A.data[j][j];
+			for(int k = 0; k < 6; k++)
+			{
+				A.data[i][k]=A.data[i][k]-pivot*A.data[j][k];
+			}
+			b[i]=b[i]-pivot*b[j];
+		}
+	}
+	// backward substituion
+	result[5]=b[5]/A.data[5][5];
+	for( int i = 4; i >= 0; i--)
+	{
+		double sum=0.0;
+		for(int j = i+1; j < 6; j++)
+		{
+			sum=sum+A.data[i][j]*result[j];
+		}
+		result[i]=(b[i]-sum)/A.data[i][i];
+	}
+}
+
+/**
+ * Tests whether A is symmetric up to rounding errors.
+ */
+template<int N>
+inline bool isSymmetric(const double (&A)[N][N])
+{
+	for (int i = 1; i < N; i++)
+		for (int j = 0; j < i; j++)
+			if (!(std::fabs(A[i][j] - A[j][i]) <= SYMMETRY_TOLERANCE*std::sqrt(std::fabs(A[i][i]*A[j][j]))))
+				return false;
+	return true;
+}
+
+/**
+ * Solves Ax = b for x with a LDL^T decomposition of the symmetric matrix A.
+ * The decomposition reads the lower triangle of A only, callers check the symmetry with isSymmetric().
+ * The loops have constant bounds, so that the compiler unrolls them for the given size.
+ * return: false if A is not definite, result is not valid then
+ */
+template<int N>
+inline bool solveLDLT(double (&result)[N], const double (&A)[N][N], const double (&b)[N])
+{
+	double L[N][N];
+	double D[N];
+	for (int j = 0; j < N; j++)
+	{
+		double d = A[j][j];
+		for (int k = 0; k < j; k++)
+			d -= L[j][k] * L[j][k] * D[k];
+		// the decomposition is only stable without pivoting
+		// if all diagonal entries have the same sign
+		if (!(d != 0.0) || (j > 0 && (d > 0.0) != (D[0] > 0.0)))
+			return false;
+		D[j] = d;
+		for (int i = j + 1; i < N; i++)
+		{
+			double sum = A[i][j];
+			for (int k = 0; k < j; k++)
+				sum -= L[i][k] * L[j][k] * D[k];
+			L[i][j] = sum / d;
+		}
+	}
+	// forward substitution with L
+	double y[N];
+	for (int i = 0; i < N; i++)
+	{
+		double sum = b[i];
+		for (int k = 0; k < i; k++)
+			sum -= L[i][k] * y[k];
+		y[i] = sum;
+	}
+	// backward substitution with D L^T
+	for (int i = N - 1; i >= 0; i--)
+	{
+		double sum = y[i] / D[i];
+		for (int k = i + 1; k < N; k++)
+			sum -= L[k][i] * result[k];
+		result[i] = sum;
+	}
+	return true;
+}
+
+/**
+ * Solves Ax = b for x.
+ * Symmetric definite matrices are decomposed without pivoting,
+ * all other matrices are solved with gaussian elimination.
+ */
+inline void solve(Vec6& result, const Mat66& A, const Vec6& b)
+{
+	if (!isSymmetric(A.data) || !solveLDLT(result, A.data, b))
+		solvePivoting(result, A, b);
+}
+
+/**
+ * Writes a linear system in the format read by readSystem().
+ */
+inline void writeSystem(std::ostream& output, const Mat66& A, const Vec6& b)
+{
+	output.write((const char*)&A, sizeof(Mat66));
+	output.write((const char*)b, sizeof(Vec6));
+}
+
+/**
+ * Reads a linear system written by writeSystem().
+ * return: false at the end of the input
+ */
+inline bool readSystem(std::istream& input, Mat66& A, Vec6& b)
+{
+	return input.read((char*)&A, sizeof(Mat66)) && input.read((char*)b, sizeof(Vec6));
+}
+
+#endif
@@ -6,6 +6,8 @@
 #ifndef DATATYPES_H
 #define DATATYPES_H
 
+#include <cstddef>
+#include <cstring>
 #include <vector>
 
 typedef struct Mat44 {
@@ -36,9 +38,33 @@ typedef struct PointCloud2 {
   int32_t height;
   int32_t width;
   int32_t point_step;
-  float* data;
+  const float* data;
 } PointCloud2;
 
+/**
+ * Read-only view of the point records of a PointCloud2.
+ * The x, y and z coordinates are the first three floats of a record, the intensity is the fifth.
+ * Values are read in place, the records are not copied.
+ */
+typedef struct PointRecordView {
+  // first record
+  const char* base;
+  // number of records
+  size_t count;
+  // distance between consecutive records in bytes
+  size_t stride;
+
+  float x(size_t i) const { return field(i, 0); }
+  float y(size_t i) const { return field(i, 1); }
+  float z(size_t i) const { return field(i, 2); }
+  float intensity(size_t i) const { return field(i, 4); }
+  float field(size_t i, int index) const {
+    float value;
+    std::memcpy(&value, base + i*stride + index*sizeof(float), sizeof(float));
+    return value;
+  }
+} PointRecordView;
+
 
 typedef struct PointsImage {
   // arrays of size image_heigt*image_width
@@ -52,5 +78,18 @@ typedef struct PointsImage {
   int32_t image_width;
 } PointsImage;
 
+/**
+ * Reference image stored in a mapped data file.
+ * Each pixel consists of intensity, distance, min_height and max_height.
+ */
+typedef struct PointsImageView {
+  int32_t image_width;
+  int32_t image_height;
+  int32_t max_y;
+  int32_t min_y;
+  // image_height*image_width pixels with four values each
+  const float* pixels;
+} PointsImageView;
+
 #endif
 